@@ -0,0 +1,185 @@
+/**
+ * @file mm_allocator.hpp
+ * @brief A standard allocator for containers, backed by the allocator's heap
+ *
+ * mm::allocator<T> works out the block size and size class of a request at
+ * compile time wherever the element count is known there, which for
+ * node-based containers (std::map, std::list, std::set, ...) is every
+ * allocation: they allocate one node at a time, so each node type goes
+ * straight to its precomputed bin through mm_malloc_class, without the
+ * round_up and find_index that malloc does. Deallocation passes the size
+ * on to mm_free_sized.
+ *
+ *   std::map<int, int, std::less<int>,
+ *            mm::allocator<std::pair<const int, int>>> m;
+ *   std::vector<char, mm::allocator<char>> v;
+ *
+ * Types aligned to more than 16 bytes go through mm_aligned_alloc.
+ *
+ * Build: compile mm.c as C and link it in; C++17 or later.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#ifndef MM_ALLOCATOR_HPP
+#define MM_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#include "mm_ext.h"
+
+namespace mm {
+
+namespace detail {
+
+/** @brief MM_CLASS_MIN_SIZES, usable in constant expressions */
+inline constexpr std::size_t class_min_sizes[MM_NUM_CLASSES] =
+    MM_CLASS_MIN_SIZES;
+
+/** @brief Largest request adjusted_size() can take without overflowing */
+inline constexpr std::size_t max_request = SIZE_MAX - 32;
+
+/**
+ * @brief The block size malloc would use for `bytes`: one header word
+ *        more, rounded up to 16, and at least 32.
+ */
+constexpr std::size_t adjusted_size(std::size_t bytes) noexcept {
+    std::size_t asize = (bytes + 8 + 15) & ~static_cast<std::size_t>(15);
+    return asize < 32 ? 32 : asize;
+}
+
+/** @brief The seg_list bin a block of `asize` bytes belongs in */
+constexpr int size_class(std::size_t asize) noexcept {
+    int c = 0;
+    while (c + 1 < MM_NUM_CLASSES && class_min_sizes[c + 1] <= asize) {
+        c++;
+    }
+    return c;
+}
+
+/** @brief Allocates `Bytes` bytes from a bin chosen at compile time */
+template <std::size_t Bytes> struct fixed_size {
+    static_assert(Bytes <= max_request, "request too large");
+
+    static constexpr std::size_t asize = adjusted_size(Bytes);
+    static constexpr int size_class = detail::size_class(asize);
+
+    static void *allocate() noexcept {
+        return mm_malloc_class(asize, size_class);
+    }
+};
+
+} // namespace detail
+
+#ifdef __cpp_lib_allocate_at_least
+template <class Pointer>
+using allocation_result = std::allocation_result<Pointer>;
+#else
+/** @brief What allocate_at_least returns, as std::allocation_result */
+template <class Pointer> struct allocation_result {
+    Pointer ptr;
+    std::size_t count;
+};
+#endif
+
+/**
+ * @brief An allocator for standard containers.
+ *
+ * All instances allocate from the same heap, so any of them can free
+ * what another allocated and they compare equal.
+ */
+template <class T> class allocator {
+  public:
+    using value_type = T;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    allocator() noexcept = default;
+
+    template <class U> allocator(const allocator<U> &) noexcept {
+    }
+
+    /** @brief Most elements one allocation can hold */
+    static constexpr size_type max_size() noexcept {
+        return detail::max_request / sizeof(T);
+    }
+
+    /**
+     * @brief Allocates room for `N` elements, with the size class fixed at
+     *        compile time.
+     */
+    template <size_type N> static T *allocate() {
+        static_assert(N <= max_size(), "request too large");
+        void *p;
+        if constexpr (alignof(T) <= 16) {
+            p = detail::fixed_size<N * sizeof(T)>::allocate();
+        } else {
+            p = mm_aligned_alloc(alignof(T), N * sizeof(T));
+        }
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(p);
+    }
+
+    /**
+     * @brief Allocates room for `n` elements.
+     *
+     * The size class is computed inline, so a constant `n` folds it away;
+     * single elements always take the precomputed path.
+     */
+    T *allocate(size_type n) {
+        if (n == 1) {
+            return allocate<1>();
+        }
+        if (n > max_size()) {
+            throw std::bad_array_new_length();
+        }
+        void *p;
+        if constexpr (alignof(T) <= 16) {
+            std::size_t asize = detail::adjusted_size(n * sizeof(T));
+            p = mm_malloc_class(asize, detail::size_class(asize));
+        } else {
+            p = mm_aligned_alloc(alignof(T), n * sizeof(T));
+        }
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(p);
+    }
+
+    /**
+     * @brief Allocates room for at least `n` elements and reports how many
+     *        fit in the block actually handed out, which may then be passed
+     *        to deallocate.
+     */
+    allocation_result<T *> allocate_at_least(size_type n) {
+        T *p = allocate(n);
+        return {p, mm_usable_size(p) / sizeof(T)};
+    }
+
+    /** @brief Frees `p`, allocated for `n` elements */
+    void deallocate(T *p, size_type n) noexcept {
+        mm_free_sized(p, n * sizeof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+    return true;
+}
+
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+    return false;
+}
+
+} // namespace mm
+
+#endif /* MM_ALLOCATOR_HPP */
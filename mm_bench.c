@@ -0,0 +1,294 @@
+/**
+ * @file mm_bench.c
+ * @brief Helpers shared by the benchmark tools
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <linux/perf_event.h>
+#include <malloc.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+#include "mm_bench.h"
+#include "mm_ext.h"
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        This allocator
+ * ---------------------------------------------------------------------------
+ */
+
+static void mm_reset(void) {
+    static bool initialized = false;
+    if (!initialized) {
+        mem_init();
+        initialized = true;
+    }
+    mem_reset_brk();
+    if (!mm_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+}
+
+static size_t mm_heap_size(void) {
+    return mem_heapsize();
+}
+
+static void mm_free_space(size_t *free_bytes, size_t *largest_free) {
+    mm_heap_stats_t stats;
+    mm_heap_stats(&stats);
+    *free_bytes = stats.free_bytes;
+    *largest_free = stats.largest_free;
+}
+
+const bench_allocator_t bench_mm = {.name = "mm",
+                                    .reset = mm_reset,
+                                    .malloc = mm_malloc,
+                                    .free = mm_free,
+                                    .realloc = mm_realloc,
+                                    .calloc = mm_calloc,
+                                    .usable_size = mm_usable_size,
+                                    .heap_size = mm_heap_size,
+                                    .free_space = mm_free_space};
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        The C library allocator
+ * ---------------------------------------------------------------------------
+ */
+
+/* heap size at the last reset, so the tool's own allocations don't count */
+static size_t libc_baseline = 0;
+
+static size_t libc_heap_total(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    return (size_t)info.arena + (size_t)info.hblkhd;
+}
+
+static void libc_reset(void) {
+    malloc_trim(0);
+    libc_baseline = libc_heap_total();
+}
+
+static size_t libc_usable_size(void *ptr) {
+    return malloc_usable_size(ptr);
+}
+
+static size_t libc_heap_size(void) {
+    size_t total = libc_heap_total();
+    return (total > libc_baseline) ? total - libc_baseline : 0;
+}
+
+static void libc_free_space(size_t *free_bytes, size_t *largest_free) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    *free_bytes = (size_t)info.fordblks;
+    *largest_free = 0;
+}
+
+const bench_allocator_t bench_libc = {.name = "libc",
+                                      .reset = libc_reset,
+                                      .malloc = malloc,
+                                      .free = free,
+                                      .realloc = realloc,
+                                      .calloc = calloc,
+                                      .usable_size = libc_usable_size,
+                                      .heap_size = libc_heap_size,
+                                      .free_space = libc_free_space};
+
+const bench_allocator_t *bench_find_allocator(const char *name) {
+    if (strcmp(name, bench_mm.name) == 0) {
+        return &bench_mm;
+    }
+    if (strcmp(name, bench_libc.name) == 0) {
+        return &bench_libc;
+    }
+    return NULL;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Measurement
+ * ---------------------------------------------------------------------------
+ */
+
+void bench_summarize(const double *samples, size_t n,
+                     bench_summary_t *summary) {
+    size_t i;
+    double sum = 0;
+    double squares = 0;
+    memset(summary, 0, sizeof(*summary));
+    summary->n = n;
+    if (n == 0) {
+        return;
+    }
+    summary->min = summary->max = samples[0];
+    for (i = 0; i < n; i++) {
+        sum += samples[i];
+        if (samples[i] < summary->min) {
+            summary->min = samples[i];
+        }
+        if (samples[i] > summary->max) {
+            summary->max = samples[i];
+        }
+    }
+    summary->mean = sum / (double)n;
+    for (i = 0; i < n; i++) {
+        squares += (samples[i] - summary->mean) * (samples[i] - summary->mean);
+    }
+    summary->stddev = (n > 1) ? sqrt(squares / (double)(n - 1)) : 0;
+}
+
+double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+size_t bench_rss_bytes(void) {
+    long pages = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == NULL) {
+        return 0;
+    }
+    if (fscanf(file, "%*s %ld", &pages) != 1) {
+        pages = 0;
+    }
+    fclose(file);
+    return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Hardware counters
+ * ---------------------------------------------------------------------------
+ */
+
+/** @brief perf_event_attr type and config of each bench_event_t */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *heading;
+} events[BENCH_NUM_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cyc/op"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "ins/op"},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+     "L1d/op"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC/op"},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+     "dTLB/op"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "br/op"},
+};
+
+int bench_counters_open(bench_counters_t *counters, bool inherit) {
+    int opened = 0;
+    int i;
+    memset(counters, 0, sizeof(*counters));
+    for (i = 0; i < BENCH_NUM_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.inherit = inherit;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counters->fd[i] =
+            (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters->fd[i] >= 0) {
+            opened++;
+        }
+    }
+    return opened;
+}
+
+void bench_counters_start(bench_counters_t *counters) {
+    int i;
+    for (i = 0; i < BENCH_NUM_EVENTS; i++) {
+        if (counters->fd[i] >= 0) {
+            ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void bench_counters_stop(bench_counters_t *counters) {
+    int i;
+    for (i = 0; i < BENCH_NUM_EVENTS; i++) {
+        uint64_t data[3]; // value, time enabled, time running
+        counters->value[i] = 0;
+        if (counters->fd[i] < 0) {
+            continue;
+        }
+        ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counters->fd[i], data, sizeof(data)) == sizeof(data) &&
+            data[2] > 0) {
+            counters->value[i] =
+                (uint64_t)((double)data[0] * (double)data[1] /
+                           (double)data[2]);
+        }
+    }
+}
+
+void bench_counters_close(bench_counters_t *counters) {
+    int i;
+    for (i = 0; i < BENCH_NUM_EVENTS; i++) {
+        if (counters->fd[i] >= 0) {
+            close(counters->fd[i]);
+            counters->fd[i] = -1;
+        }
+    }
+}
+
+void bench_counters_print_header(FILE *out) {
+    int i;
+    for (i = 0; i < BENCH_NUM_EVENTS; i++) {
+        fprintf(out, " %9s", events[i].heading);
+    }
+    fprintf(out, " %5s", "IPC");
+}
+
+void bench_counters_print(FILE *out, const bench_counters_t *counters,
+                          double ops) {
+    int i;
+    for (i = 0; i < BENCH_NUM_EVENTS; i++) {
+        if (counters->fd[i] >= 0) {
+            fprintf(out, " %9.2f", (double)counters->value[i] / ops);
+        } else {
+            fprintf(out, " %9s", "-");
+        }
+    }
+    if (counters->fd[BENCH_CYCLES] >= 0 &&
+        counters->fd[BENCH_INSTRUCTIONS] >= 0 &&
+        counters->value[BENCH_CYCLES] > 0) {
+        fprintf(out, " %5.2f",
+                (double)counters->value[BENCH_INSTRUCTIONS] /
+                    (double)counters->value[BENCH_CYCLES]);
+    } else {
+        fprintf(out, " %5s", "-");
+    }
+}
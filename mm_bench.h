@@ -0,0 +1,137 @@
+/**
+ * @file mm_bench.h
+ * @brief Helpers shared by the benchmark tools
+ *
+ * The tools run the same workload against this allocator and against the
+ * system malloc through a bench_allocator_t. They are built with mm.c
+ * compiled under -DDRIVER, so that mm.c exports mm_malloc and friends
+ * while malloc still means the C library's:
+ *
+ *   cc -O2 -DDRIVER -o mm_replay mm_replay.c mm_bench.c mm_trace.c \
+ *       mm.c memlib.c
+ *
+ * Where the kernel allows perf_event_open, the tools also count hardware
+ * events around each timed phase (bench_counters_t) and print them per
+ * operation next to the throughput; -P turns this off.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#ifndef MM_BENCH_H
+#define MM_BENCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** @brief An allocator under test */
+typedef struct bench_allocator {
+    const char *name;
+    void (*reset)(void); // start again from an empty heap, if possible
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*calloc)(size_t elements, size_t size);
+    size_t (*usable_size)(void *ptr);
+    size_t (*heap_size)(void); // bytes obtained from the OS since reset
+    // free bytes inside the heap and the largest free extent (0 if unknown)
+    void (*free_space)(size_t *free_bytes, size_t *largest_free);
+} bench_allocator_t;
+
+/** @brief This allocator, on the memlib heap */
+extern const bench_allocator_t bench_mm;
+
+/** @brief The C library allocator */
+extern const bench_allocator_t bench_libc;
+
+/**
+ * @brief Looks up an allocator by name ("mm" or "libc").
+ * @return The allocator, or NULL
+ */
+const bench_allocator_t *bench_find_allocator(const char *name);
+
+/** @brief Mean, standard deviation and range of a set of samples */
+typedef struct bench_summary {
+    size_t n;
+    double mean;
+    double stddev; // sample standard deviation, 0 if n < 2
+    double min;
+    double max;
+} bench_summary_t;
+
+/**
+ * @brief Summarizes `n` samples.
+ */
+void bench_summarize(const double *samples, size_t n,
+                     bench_summary_t *summary);
+
+/**
+ * @brief Returns CLOCK_MONOTONIC in nanoseconds.
+ */
+double bench_now_ns(void);
+
+/**
+ * @brief Returns the current resident set size in bytes, or 0 if unknown.
+ */
+size_t bench_rss_bytes(void);
+
+/** @brief The hardware events the tools can count */
+typedef enum bench_event {
+    BENCH_CYCLES,
+    BENCH_INSTRUCTIONS,
+    BENCH_L1D_MISSES,  // L1 data cache read misses
+    BENCH_LLC_MISSES,  // last-level cache misses
+    BENCH_DTLB_MISSES, // data TLB read misses
+    BENCH_BRANCH_MISSES,
+    BENCH_NUM_EVENTS
+} bench_event_t;
+
+/**
+ * @brief A set of per-event counters.
+ *
+ * Events are opened one by one, so a kernel or PMU that lacks one of them
+ * (or forbids perf events altogether) just leaves that fd at -1.
+ */
+typedef struct bench_counters {
+    int fd[BENCH_NUM_EVENTS];
+    uint64_t value[BENCH_NUM_EVENTS]; // after bench_counters_stop()
+} bench_counters_t;
+
+/**
+ * @brief Opens the counters for the calling thread. With `inherit`, they
+ *        also count threads created afterwards. All counters start
+ *        disabled.
+ * @return The number of events that could be opened
+ */
+int bench_counters_open(bench_counters_t *counters, bool inherit);
+
+/**
+ * @brief Zeroes and enables the open counters.
+ */
+void bench_counters_start(bench_counters_t *counters);
+
+/**
+ * @brief Disables the counters and reads them into `value`, scaled up if
+ *        the kernel had to multiplex them.
+ */
+void bench_counters_stop(bench_counters_t *counters);
+
+/**
+ * @brief Closes the counters.
+ */
+void bench_counters_close(bench_counters_t *counters);
+
+/**
+ * @brief Prints the column headings for bench_counters_print().
+ */
+void bench_counters_print_header(FILE *out);
+
+/**
+ * @brief Prints every event divided by `ops`, and instructions per cycle;
+ *        "-" for events that could not be counted.
+ */
+void bench_counters_print(FILE *out, const bench_counters_t *counters,
+                          double ops);
+
+#endif /* MM_BENCH_H */
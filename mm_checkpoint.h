@@ -0,0 +1,76 @@
+/**
+ * @file mm_checkpoint.h
+ * @brief Heap checkpoint and delta file formats
+ *
+ * mm_checkpoint() (see mm_ext.h) saves the whole heap as a base file in
+ * the format below and mm_restore() maps it back in as the heap.
+ *
+ *   base  := header pad image
+ *
+ * The header is an mm_checkpoint_header_t in the byte order of the
+ * machine that wrote it. `image` is a byte copy of the heap from
+ * mem_heap_lo(), starting at `image_offset`, which is a multiple of the
+ * page size so that the image can be mmap'ed directly.
+ *
+ * mm_checkpoint_delta() appends the heap pages written since the previous
+ * checkpoint to a delta file, and mm_checkpoint_compact() merges a delta
+ * file into its base.
+ *
+ *   delta  := record*
+ *   record := mm_checkpoint_record_t range*
+ *   range  := mm_checkpoint_range_t bytes{length}
+ *
+ * A record replaces the metadata of the base and overwrites the image at
+ * the given offsets; the image grows to the record's `heap_size`. A record
+ * cut short by a crash extends past the end of the file and is ignored
+ * along with everything after it.
+ *
+ * Nothing in the image depends on where the heap was mapped: free list
+ * links are stored as offsets from the start of the heap, with 0 for
+ * none, and so are `heap_start` and the `seg_list` heads in the metadata.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#ifndef MM_CHECKPOINT_H
+#define MM_CHECKPOINT_H
+
+#include <stdint.h>
+
+/** @brief File magics, followed by MM_CHECKPOINT_VERSION */
+#define MM_CHECKPOINT_MAGIC "MMCK"
+#define MM_CHECKPOINT_DELTA_MAGIC "MMDL"
+#define MM_CHECKPOINT_VERSION 2
+
+/** @brief Most seg_list bins a checkpoint may describe */
+#define MM_CHECKPOINT_MAX_BINS 32
+
+/** @brief The allocator state that lives outside the heap */
+typedef struct mm_checkpoint_meta {
+    uint64_t heap_size;  // bytes in the image
+    uint64_t heap_start; // offset of the first block header
+    uint64_t nbins;
+    uint64_t seg_list[MM_CHECKPOINT_MAX_BINS]; // list heads, 0 if empty
+} mm_checkpoint_meta_t;
+
+typedef struct mm_checkpoint_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t image_offset; // file offset of the heap image
+    mm_checkpoint_meta_t meta;
+} mm_checkpoint_header_t;
+
+typedef struct mm_checkpoint_record {
+    char magic[4];
+    uint32_t version;
+    uint64_t record_size; // bytes in the record, this header included
+    uint64_t nranges;
+    mm_checkpoint_meta_t meta;
+} mm_checkpoint_record_t;
+
+typedef struct mm_checkpoint_range {
+    uint64_t offset; // into the image
+    uint64_t length;
+} mm_checkpoint_range_t;
+
+#endif /* MM_CHECKPOINT_H */
@@ -0,0 +1,610 @@
+/**
+ * @file mm_ext.h
+ * @brief Extensions to the mm.h interface
+ *
+ * mm.h is fixed by the driver, so everything mm.c offers beyond
+ * mm_init/malloc/free/realloc/calloc/mm_checkheap is declared here.
+ *
+ * Instrumentation is opt-in: unless mm.c is compiled with the build flag
+ * named next to a function, that function is a cheap no-op and the
+ * allocator's fast paths carry no extra code.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#ifndef MM_EXT_H
+#define MM_EXT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Number of seg_list bins, which double as request size classes */
+#define MM_NUM_CLASSES 15
+
+/**
+ * @brief Smallest block size in each class; a block of size s is in the
+ *        last class whose minimum is at most s. Must match list0..list14
+ *        in mm.c.
+ */
+#define MM_CLASS_MIN_SIZES                                                     \
+    {32,   64,   96,    128,   160,   192,   256,  512,                        \
+     1024, 2048, 4096,  8192,  16384, 32768, 65536}
+
+/** @brief The public allocator operations, as tagged by instrumentation */
+typedef enum mm_op {
+    MM_OP_MALLOC,
+    MM_OP_FREE,
+    MM_OP_REALLOC,
+    MM_OP_CALLOC,
+    MM_OP_EXTEND_HEAP, // internal, but the usual source of latency spikes
+    MM_NUM_OPS
+} mm_op_t;
+
+/*
+ * ---------------------------------------------------------------------------
+ *                  Heap introspection (always available)
+ * ---------------------------------------------------------------------------
+ */
+
+/** @brief A summary of the heap, as produced by mm_heap_stats() */
+typedef struct mm_heap_stats {
+    size_t heap_size;    // bytes obtained from the memory system
+    size_t alloc_blocks; // allocated blocks
+    size_t alloc_bytes;  // their total size, headers included
+    size_t free_blocks;  // free blocks
+    size_t free_bytes;   // their total size
+    size_t largest_free; // size of the largest free block
+} mm_heap_stats_t;
+
+/**
+ * @brief Returns the payload bytes usable at `ptr`, which is at least the
+ *        size it was allocated with (0 for NULL).
+ */
+size_t mm_usable_size(void *ptr);
+
+/**
+ * @brief Walks the whole heap and fills in `stats`.
+ */
+void mm_heap_stats(mm_heap_stats_t *stats);
+
+/**
+ * @brief Allocates `size` bytes whose address is a multiple of `align`, a
+ *        power of two. Alignments up to 16 cost nothing extra; larger ones
+ *        free the bytes skipped to reach the alignment.
+ * @return NULL for an invalid alignment or if the heap is out of memory
+ */
+void *mm_aligned_alloc(size_t align, size_t size);
+
+/**
+ * @brief Frees `ptr`, which was allocated with `size` bytes (or fewer).
+ */
+void mm_free_sized(void *ptr, size_t size);
+
+/**
+ * @brief Allocates a block of exactly `asize` bytes, header included, from
+ *        class `size_class`. `asize` must be a request plus 8 rounded up
+ *        to a multiple of 16 (and at least 32), and `size_class` its class
+ *        by MM_CLASS_MIN_SIZES; mm_allocator.hpp works both out at compile
+ *        time.
+ * @return The payload pointer, with asize - 8 usable bytes, or NULL
+ */
+void *mm_malloc_class(size_t asize, int size_class);
+
+/**
+ * @brief Writes a compact binary description of every block and of the
+ *        free list heads to `fd` (see mm_snapshot.h); mm_snapanalyze
+ *        reads it offline.
+ * @return false if the heap is not initialized or a write failed
+ */
+bool mm_snapshot(int fd);
+
+/**
+ * @brief Saves the whole heap to `path` (see mm_checkpoint.h), replacing
+ *        any earlier checkpoint there only once the new one is complete.
+ * @return false if the heap is not initialized or a write failed
+ */
+bool mm_checkpoint(const char *path);
+
+/**
+ * @brief Replaces the heap with the checkpoint in `path`.
+ *
+ * The image is mapped copy-on-write where the heap is page aligned, so a
+ * restore costs little more than the mmap; pages are read as they are
+ * touched. Blocks allocated at checkpoint time stay allocated at the same
+ * offsets from mem_heap_lo(). Every pointer into the previous heap becomes
+ * invalid. Until the heap has written a page, a write to the file shows
+ * through, so `path` must not be modified in place while the restored
+ * heap is in use; mm_checkpoint and mm_checkpoint_compact replace it.
+ *
+ * @return false if `path` cannot be opened or is not a valid checkpoint
+ *         of this allocator, in which case the heap is left as it was, or
+ *         if the image could not be loaded, in which case the heap is left
+ *         empty
+ */
+bool mm_restore(const char *path);
+
+/**
+ * @brief Saves the whole heap to `base_path` like mm_checkpoint and starts
+ *        tracking which heap pages are written from then on.
+ *
+ * Tracking uses the kernel's soft-dirty bits where available. Otherwise
+ * the heap is write-protected and a SIGSEGV handler notes the first write
+ * to each page; until a page has been written once, system calls that
+ * write into it (such as read(2) into a malloc'ed buffer) fail with
+ * EFAULT. A new base makes older delta files useless, so start a new
+ * delta file with it.
+ *
+ * @return false if the checkpoint failed or tracking could not start
+ */
+bool mm_checkpoint_begin(const char *base_path);
+
+/**
+ * @brief Appends the heap pages written since the last checkpoint, with
+ *        seg_list and the heap size, to the delta file `delta_path`.
+ *
+ * Costs I/O in proportion to the pages written rather than to the heap.
+ * Must not run concurrently with allocator calls or writes to the heap.
+ *
+ * @return false if tracking is off or the write failed, in which case the
+ *         file is left as it was
+ */
+bool mm_checkpoint_delta(const char *delta_path);
+
+/**
+ * @brief Stops tracking started by mm_checkpoint_begin.
+ */
+void mm_checkpoint_end(void);
+
+/**
+ * @brief Merges the records of `delta_path` into the base checkpoint at
+ *        `base_path` and empties the delta file; mm_restore(base_path)
+ *        then restores the heap as of the last delta.
+ *
+ * The merged image is written to `base_path`.tmp and renamed over the
+ * base, so a heap restored from the old base is not disturbed. Safe to
+ * rerun after a crash. A record cut short by a crash is dropped.
+ *
+ * @return false if either file could not be read or written
+ */
+bool mm_checkpoint_compact(const char *base_path, const char *delta_path);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                  Heap instances (always available)
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief An independent heap with its own free lists and its own memory.
+ *
+ * malloc, free, realloc and calloc use the default heap, which gets its
+ * memory from memlib. Heaps made by mm_heap_create reserve `capacity`
+ * bytes of address space of their own, so a subsystem's memory can be
+ * accounted for and released at once. A block must be freed or
+ * reallocated through the heap it came from. Which calls may overlap is
+ * set out under "Thread safety" below.
+ */
+typedef struct mm_heap mm_heap_t;
+
+/**
+ * @brief Returns the heap behind malloc, free, realloc and calloc.
+ */
+mm_heap_t *mm_heap_default(void);
+
+/**
+ * @brief Creates a heap that can grow to `capacity` bytes. Only the pages
+ *        the heap grows into are backed by memory.
+ * @return NULL if the memory cannot be reserved
+ */
+mm_heap_t *mm_heap_create(size_t capacity);
+
+/**
+ * @brief Releases a heap made by mm_heap_create and every block in it.
+ *        Does nothing for the default heap.
+ */
+void mm_heap_destroy(mm_heap_t *heap);
+
+void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+void mm_heap_free(mm_heap_t *heap, void *ptr);
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size);
+void *mm_heap_calloc(mm_heap_t *heap, size_t elements, size_t size);
+
+/**
+ * @brief Fills in `stats` for `heap`, like mm_heap_stats for the default
+ *        heap.
+ */
+void mm_heap_get_stats(mm_heap_t *heap, mm_heap_stats_t *stats);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                  Shared heaps (always available)
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief A heap in a MAP_SHARED file or memfd that several processes can
+ *        allocate from at once.
+ *
+ * The heap keeps its state in the mapping, with free list links stored as
+ * offsets, so each process may map it at a different address; pointers
+ * are passed between processes as offsets (mm_shared_offset and
+ * mm_shared_pointer). Calls take a robust process-shared mutex in the
+ * mapping. Within one process, the rules under "Thread safety" below
+ * apply.
+ *
+ * If a process dies inside a call, the next call checks the whole heap
+ * before going on. A heap that fails the check is poisoned for every
+ * process: mm_shared_malloc returns NULL, mm_shared_free does nothing and
+ * mm_shared_checkheap returns false from then on.
+ */
+typedef struct mm_shared mm_shared_t;
+
+/**
+ * @brief Makes the empty file `fd` a shared heap that can grow to
+ *        `capacity` bytes, and maps it.
+ * @return NULL if the file cannot be sized or mapped
+ */
+mm_shared_t *mm_shared_create(int fd, size_t capacity);
+
+/**
+ * @brief Maps the shared heap in `fd`, made by mm_shared_create in this or
+ *        another process. `fd` may be closed afterwards.
+ * @return NULL if `fd` does not hold a shared heap
+ */
+mm_shared_t *mm_shared_attach(int fd);
+
+/**
+ * @brief Unmaps a shared heap from this process.
+ */
+void mm_shared_detach(mm_shared_t *shm);
+
+void *mm_shared_malloc(mm_shared_t *shm, size_t size);
+void mm_shared_free(mm_shared_t *shm, void *ptr);
+
+/**
+ * @brief Checks a shared heap like mm_checkheap.
+ * @return false if a check failed or the heap is poisoned
+ */
+bool mm_shared_checkheap(mm_shared_t *shm, int line);
+
+/**
+ * @brief Converts between pointers into a shared heap and offsets that
+ *        mean the same block in every process (NULL is offset 0).
+ */
+uint64_t mm_shared_offset(mm_shared_t *shm, const void *ptr);
+void *mm_shared_pointer(mm_shared_t *shm, uint64_t offset);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                  Arenas (always available)
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief A region of objects that are all freed together.
+ *
+ * An arena takes large chunks from the heap with malloc and bump-allocates
+ * inside them; its objects cannot be freed one by one. Not thread-safe.
+ */
+typedef struct mm_arena mm_arena_t;
+
+/**
+ * @brief Creates an arena that takes `chunk_size`-byte chunks from the
+ *        heap (0 for 64 KiB).
+ * @return NULL if the heap is out of memory
+ */
+mm_arena_t *mm_arena_create(size_t chunk_size);
+
+/**
+ * @brief Allocates `size` bytes, 16-byte aligned, from `arena`.
+ * @return NULL for size 0 or if the heap is out of memory
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+
+/**
+ * @brief Frees every object of `arena` in a few calls to free; one chunk
+ *        is kept for the arena's next use.
+ */
+void mm_arena_reset(mm_arena_t *arena);
+
+/**
+ * @brief Frees every object of `arena` and the arena itself.
+ */
+void mm_arena_destroy(mm_arena_t *arena);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                  Object pools (always available)
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief A pool of fixed-size objects with type-stable storage.
+ *
+ * A pool takes chunks from the heap with malloc and keeps its free
+ * objects on a list of its own, so alloc and free are a few loads and
+ * stores with no size classification. Memory goes back to the heap only
+ * when the pool is destroyed. Not thread-safe.
+ */
+typedef struct mm_pool mm_pool_t;
+
+/** @brief Builds an object when its chunk is taken from the heap */
+typedef void (*mm_pool_ctor_t)(void *obj, void *arg);
+
+/** @brief Tears an object down when its pool is destroyed */
+typedef void (*mm_pool_dtor_t)(void *obj, void *arg);
+
+/**
+ * @brief Creates a pool of `obj_size`-byte objects aligned to `align`, a
+ *        power of two (0 for 16).
+ * @return NULL for an invalid size or alignment, or if the heap is out of
+ *         memory
+ */
+mm_pool_t *mm_pool_create(size_t obj_size, size_t align);
+
+/**
+ * @brief Creates a pool whose objects are constructed once and keep their
+ *        state across mm_pool_free and mm_pool_alloc, as in Bonwick's
+ *        object caches.
+ *
+ * `ctor` runs on each object when the pool grows and `dtor` on each object
+ * when the pool is destroyed; either may be NULL. Objects must be freed
+ * in their constructed state.
+ */
+mm_pool_t *mm_pool_create_cache(size_t obj_size, size_t align,
+                                mm_pool_ctor_t ctor, mm_pool_dtor_t dtor,
+                                void *arg);
+
+/**
+ * @brief Returns an object of `pool`, or NULL if the heap is out of memory.
+ */
+void *mm_pool_alloc(mm_pool_t *pool);
+
+/**
+ * @brief Returns `obj` to `pool`.
+ */
+void mm_pool_free(mm_pool_t *pool, void *obj);
+
+/**
+ * @brief Destroys every object of `pool` and frees its memory.
+ */
+void mm_pool_destroy(mm_pool_t *pool);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                  find_fit statistics (build with -DMM_FIT_STATS)
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief Clears the find_fit histograms.
+ */
+void mm_fit_stats_reset(void);
+
+/**
+ * @brief Prints the find_fit histograms collected since the last reset.
+ *
+ * For each requested size class (the seg_list bin of the adjusted size)
+ * this prints the number of calls and misses, the nodes visited per call as
+ * a log2 histogram, the number of bins probed per call, and the bin the fit
+ * was finally found in. The total number of nodes walked inside each bin is
+ * printed last. Only searches of the default heap are counted.
+ *
+ * @param[in] out The stream to print to
+ */
+void mm_fit_stats_dump(FILE *out);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                  Latency histograms (build with -DMM_LATENCY)
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief Number of log2 latency buckets. Bucket 0 counts calls that took
+ *        0 ticks, bucket b > 0 counts calls that took [2^(b-1), 2^b) ticks.
+ */
+#define MM_LATENCY_BUCKETS 48
+
+/**
+ * @brief A copy of the latency histograms at one point in time.
+ *
+ * Latencies are in ticks of mm_latency_now(): TSC cycles on x86-64, the
+ * virtual counter on AArch64 and nanoseconds elsewhere. Rows are indexed
+ * by operation and by the size class of the request (the seg_list bin of
+ * the adjusted size; for free, the bin of the block being freed). Only
+ * the default heap is timed, so heap growth inside a call on another heap
+ * is not counted.
+ */
+typedef struct mm_latency_snapshot {
+    uint64_t taken_at; // mm_latency_now() when the snapshot was taken
+    uint64_t count[MM_NUM_OPS][MM_NUM_CLASSES];
+    uint64_t total[MM_NUM_OPS][MM_NUM_CLASSES];
+    uint64_t max[MM_NUM_OPS][MM_NUM_CLASSES];
+    uint64_t hist[MM_NUM_OPS][MM_NUM_CLASSES][MM_LATENCY_BUCKETS];
+} mm_latency_snapshot_t;
+
+/**
+ * @brief Reads the counter used to time allocator calls, so that callers
+ *        can place their own events on the same time base.
+ */
+uint64_t mm_latency_now(void);
+
+/**
+ * @brief Clears the latency histograms.
+ */
+void mm_latency_reset(void);
+
+/**
+ * @brief Copies the current latency histograms into `snap`.
+ *
+ * Subtracting two snapshots gives the histograms of the calls made
+ * between them.
+ */
+void mm_latency_snapshot(mm_latency_snapshot_t *snap);
+
+/**
+ * @brief Returns an upper bound, in ticks, of the `q` quantile (0 < q <= 1)
+ *        of one operation's latency.
+ * @param[in] snap
+ * @param[in] op
+ * @param[in] size_class A size class, or -1 to merge all classes
+ * @param[in] q
+ * @return The upper edge of the bucket holding the quantile, or 0 if the
+ *         row is empty
+ */
+uint64_t mm_latency_quantile(const mm_latency_snapshot_t *snap, mm_op_t op,
+                             int size_class, double q);
+
+/**
+ * @brief Prints count, mean, p50, p99, p99.9 and max for every operation
+ *        and size class that has seen calls.
+ */
+void mm_latency_dump(FILE *out);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                  Trace recorder (build with -DMM_TRACE)
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief Starts recording every malloc, free, realloc and calloc call.
+ *
+ * Calls are buffered in per-thread rings and streamed to `path` in the
+ * binary format of mm_trace.h. mm_tracecvt turns the file into a driver
+ * text trace.
+ *
+ * @param[in] path The trace file, created or truncated
+ * @return false if a recording is already running or `path` cannot be
+ *         opened, and always without MM_TRACE
+ */
+bool mm_trace_start(const char *path);
+
+/**
+ * @brief Writes out everything recorded so far.
+ */
+void mm_trace_flush(void);
+
+/**
+ * @brief Flushes and closes the trace file.
+ */
+void mm_trace_stop(void);
+
+/*
+ * ---------------------------------------------------------------------------
+ *          Thread safety (build with -DMM_THREADSAFE or MM_PRELOAD)
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * Without MM_THREADSAFE, no two allocator calls may overlap, whichever
+ * heaps they are on.
+ *
+ * With MM_THREADSAFE, malloc, free, realloc, calloc, mm_aligned_alloc,
+ * mm_free_sized, mm_malloc_class, and the mm_heap_* calls on the default
+ * heap may be made from any thread; they share one spin-then-sleep lock.
+ * So may the mm_shared_* calls, which take the shared heap's own mutex.
+ * Each heap made by mm_heap_create, and each arena and pool, must be used
+ * by one thread at a time; different ones may be used by different
+ * threads at once. The checkers, snapshots and checkpoints may only run
+ * while no other thread is calling the allocator, and mm_check_set_level
+ * before other threads start.
+ */
+
+/** @brief Counters of the default heap's lock */
+typedef struct mm_lock_stats {
+    uint64_t acquisitions; // times the lock was taken
+    uint64_t contended;    // of them, times it was held by another thread
+    uint64_t sleeps;       // of those, times the thread had to sleep
+    uint64_t wait_ns;      // total time spent waiting for it
+} mm_lock_stats_t;
+
+/**
+ * @brief Copies the lock counters into `stats` (all zero without
+ *        MM_THREADSAFE).
+ */
+void mm_lock_stats(mm_lock_stats_t *stats);
+
+/**
+ * @brief Clears the lock counters.
+ */
+void mm_lock_stats_reset(void);
+
+/**
+ * @brief Prints the lock counters and the mean wait per contended
+ *        acquisition.
+ */
+void mm_lock_stats_dump(FILE *out);
+
+/*
+ * ---------------------------------------------------------------------------
+ *          Parallel heap checking (build with -DMM_PARALLEL_CHECK)
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief Checks the heap like mm_checkheap, with the work spread over
+ *        `nthreads` threads (0 for one per online CPU).
+ *
+ * The heap is split into ranges at free blocks, and the ranges and the
+ * free lists are checked concurrently. Prints the same diagnostics as
+ * mm_checkheap. Must not run concurrently with allocator calls. Without
+ * MM_PARALLEL_CHECK, or with one thread, this is mm_checkheap.
+ *
+ * @return true if every invariant holds
+ */
+bool mm_checkheap_parallel(int line, int nthreads);
+
+/*
+ * ---------------------------------------------------------------------------
+ *          Runtime heap checking (build with -DMM_RUNTIME_CHECK or DEBUG)
+ * ---------------------------------------------------------------------------
+ */
+
+/** @brief How much checking each operation does */
+typedef enum mm_check_level {
+    MM_CHECK_OFF,     // none
+    MM_CHECK_SAMPLED, // a full mm_checkheap on sampled operations only
+    MM_CHECK_LOCAL,   // the blocks each operation touched, and a full
+                      // mm_checkheap every MM_CHECK_INTERVAL operations
+    MM_CHECK_FULL     // a full mm_checkheap after every operation
+} mm_check_level_t;
+
+/**
+ * @brief Selects the checking level.
+ *
+ * Unless this is called first, the MM_CHECK environment variable is read
+ * at the first heap check: "off", "local", "full", "sampled:N" (every Nth
+ * operation) or "sampled:P" with P below 1, such as 0.001 or 1e-3 (each
+ * operation with probability P). DEBUG builds start at MM_CHECK_LOCAL,
+ * MM_RUNTIME_CHECK builds at MM_CHECK_OFF. A failed check asserts in
+ * DEBUG builds and otherwise prints the line and aborts.
+ *
+ * @param[in] level
+ * @param[in] period For MM_CHECK_SAMPLED: check every `period`-th
+ *                   operation of each thread, or 0 to sample by
+ *                   `probability`
+ * @param[in] probability For MM_CHECK_SAMPLED with a period of 0
+ * @return false if the arguments are invalid, and always without
+ *         MM_RUNTIME_CHECK or DEBUG
+ */
+bool mm_check_set_level(mm_check_level_t level, unsigned long period,
+                        double probability);
+
+/**
+ * @brief Returns the current checking level.
+ */
+mm_check_level_t mm_check_get_level(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MM_EXT_H */
@@ -0,0 +1,388 @@
+/**
+ * @file mm_fragbench.c
+ * @brief Adversarial fragmentation workloads
+ *
+ * Usage:
+ *   mm_fragbench [-s scale] [-a mm|libc|both] [-q] [workload...]
+ *
+ * Each workload is built to defeat a first-fit segregated allocator: the
+ * free space it leaves behind is plentiful but never the right shape for
+ * the next requests. The tool samples the heap size and the live
+ * (requested) bytes after every round and prints the series, so that a
+ * change to find_fit, split_block or add_to_list shows up as a different
+ * curve. The summary line gives the worst case:
+ *
+ *   peak heap / peak live   how much memory the workload really cost
+ *   worst heap / live       the largest ratio seen at any sample
+ *
+ *   sawtooth   rounds of ramp-up and tear-down; every round uses blocks
+ *              16 bytes larger than the last, and a quarter of each round
+ *              stays live for two more rounds, so the holes left behind
+ *              are always just too small
+ *   pinning    short-lived blocks interleaved with long-lived 16-byte
+ *              pins; once the short ones are freed, the next round asks
+ *              for blocks one size step larger than the gaps
+ *   straddle   free blocks sitting just above a seg_list boundary,
+ *              separated by pins, and requests just below it: each request
+ *              misses its own (empty) list, splits a block of the next one
+ *              and leaves a splinter that cannot coalesce
+ *   realloc    a buffer grown by realloc, with a small block pinned after
+ *              each step, so that it can never grow in place
+ *
+ * -q prints only the summary lines. Every run happens in a child process
+ * of its own, so that neither allocator inherits the free space (or the
+ * stdio buffers) of an earlier run.
+ *
+ * Build: cc -O2 -DDRIVER -o mm_fragbench mm_fragbench.c mm_bench.c \
+ *            mm.c memlib.c -lm
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mm_bench.h"
+#include "mm_ext.h"
+
+/** @brief Most samples one run keeps */
+#define MAX_SAMPLES 256
+
+/** @brief Smallest block size of each seg_list class */
+static const size_t class_min_sizes[MM_NUM_CLASSES] = MM_CLASS_MIN_SIZES;
+
+/** @brief Block size boundaries of seg_list, from list1 to list14 */
+static const size_t *const list_bounds = class_min_sizes + 1;
+
+#define NUM_BOUNDS (MM_NUM_CLASSES - 1)
+
+/** @brief One point of the heap-against-live series */
+typedef struct sample {
+    size_t live;
+    size_t heap;
+} sample_t;
+
+/** @brief The allocator under test and what we know of its heap */
+typedef struct frag_run {
+    const bench_allocator_t *alloc;
+    size_t live; // bytes requested and not yet freed
+    size_t nsamples;
+    sample_t samples[MAX_SAMPLES];
+} frag_run_t;
+
+typedef struct fragbench {
+    const char *name;
+    void (*run)(frag_run_t *run, size_t scale);
+} fragbench_t;
+
+/**
+ * the request that gives a block of exactly `block` bytes in mm.c (one
+ * header word, 16-byte alignment)
+ */
+static size_t request_for(size_t block) {
+    return block - 8;
+}
+
+static void *frag_malloc(frag_run_t *run, size_t size) {
+    void *p = run->alloc->malloc(size);
+    if (p == NULL) {
+        fprintf(stderr, "%s: malloc(%zu) failed\n", run->alloc->name, size);
+        exit(1);
+    }
+    *(volatile char *)p = 1;
+    run->live += size;
+    return p;
+}
+
+static void frag_free(frag_run_t *run, void *ptr, size_t size) {
+    run->alloc->free(ptr);
+    run->live -= size;
+}
+
+static void sample(frag_run_t *run) {
+    if (run->nsamples < MAX_SAMPLES) {
+        run->samples[run->nsamples].live = run->live;
+        run->samples[run->nsamples].heap = run->alloc->heap_size();
+        run->nsamples++;
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        The workloads
+ * ---------------------------------------------------------------------------
+ */
+
+static void sawtooth_run(frag_run_t *run, size_t scale) {
+    size_t n = scale << 12;
+    void **kept[3] = {NULL, NULL, NULL};
+    size_t kept_size[3] = {0, 0, 0};
+    void **round_blocks = malloc(n * sizeof(void *));
+    int round, slot;
+    size_t i;
+    for (round = 0; round < 48; round++) {
+        size_t size = request_for(48 + 16 * (size_t)round);
+        slot = round % 3;
+        if (kept[slot] != NULL) { // survivors of three rounds ago
+            for (i = 0; i < n / 4; i++) {
+                frag_free(run, kept[slot][i], kept_size[slot]);
+            }
+            free(kept[slot]);
+        }
+        kept[slot] = malloc((n / 4) * sizeof(void *));
+        kept_size[slot] = size;
+        for (i = 0; i < n; i++) {
+            round_blocks[i] = frag_malloc(run, size);
+        }
+        sample(run); // top of the tooth
+        for (i = 0; i < n; i++) {
+            if (i % 4 == 0) {
+                kept[slot][i / 4] = round_blocks[i];
+            } else {
+                frag_free(run, round_blocks[i], size);
+            }
+        }
+        sample(run); // bottom
+    }
+    for (slot = 0; slot < 3; slot++) {
+        for (i = 0; i < n / 4; i++) {
+            frag_free(run, kept[slot][i], kept_size[slot]);
+        }
+        free(kept[slot]);
+    }
+    free(round_blocks);
+}
+
+static void pinning_run(frag_run_t *run, size_t scale) {
+    size_t n = scale << 12;
+    size_t rounds = 24;
+    void **pins = malloc(rounds * n * sizeof(void *));
+    void **shorts = malloc(n * sizeof(void *));
+    size_t npins = 0;
+    size_t round, i;
+    for (round = 0; round < rounds; round++) {
+        size_t size = request_for(64 + 16 * round);
+        for (i = 0; i < n; i++) {
+            shorts[i] = frag_malloc(run, size);
+            pins[npins++] = frag_malloc(run, 16);
+        }
+        sample(run);
+        for (i = 0; i < n; i++) {
+            frag_free(run, shorts[i], size);
+        }
+        sample(run);
+    }
+    for (i = 0; i < npins; i++) {
+        frag_free(run, pins[i], 16);
+    }
+    free(pins);
+    free(shorts);
+}
+
+/*
+ * Every boundary gets the same number of bytes, so that the large lists
+ * do not drown out the small ones.
+ */
+static void straddle_run(frag_run_t *run, size_t scale) {
+    size_t bytes = scale << 20;
+    size_t most = bytes / list_bounds[0];
+    void **pins = malloc(NUM_BOUNDS * most * sizeof(void *));
+    void **blocks = malloc(most * sizeof(void *));
+    void **small = malloc(NUM_BOUNDS * most * sizeof(void *));
+    size_t nsmall = 0;
+    size_t npins = 0;
+    size_t b, i;
+    for (b = 0; b < NUM_BOUNDS; b++) {
+        size_t n = bytes / list_bounds[b];
+        size_t above = request_for(list_bounds[b] + 16);
+        size_t below = request_for(list_bounds[b] - 16);
+        for (i = 0; i < n; i++) {
+            blocks[i] = frag_malloc(run, above);
+            pins[npins++] = frag_malloc(run, 16);
+        }
+        for (i = 0; i < n; i++) {
+            frag_free(run, blocks[i], above);
+        }
+        // the holes are one list up from the requests: each request takes
+        // a hole and leaves a 32-byte splinter between it and its pin
+        for (i = 0; i < n; i++) {
+            small[nsmall++] = frag_malloc(run, below);
+        }
+        sample(run);
+    }
+    nsmall = 0;
+    for (b = 0; b < NUM_BOUNDS; b++) {
+        size_t n = bytes / list_bounds[b];
+        size_t below = request_for(list_bounds[b] - 16);
+        for (i = 0; i < n; i++) {
+            frag_free(run, small[nsmall++], below);
+        }
+    }
+    sample(run);
+    for (i = 0; i < npins; i++) {
+        frag_free(run, pins[i], 16);
+    }
+    free(pins);
+    free(blocks);
+    free(small);
+}
+
+static void realloc_run(frag_run_t *run, size_t scale) {
+    size_t steps = 64;
+    size_t step_size = scale << 12;
+    size_t size = step_size;
+    void **pins = malloc(steps * sizeof(void *));
+    void *buf = frag_malloc(run, size);
+    size_t i;
+    for (i = 0; i < steps; i++) {
+        void *bigger = run->alloc->realloc(buf, size + step_size);
+        if (bigger == NULL) {
+            fprintf(stderr, "%s: realloc failed\n", run->alloc->name);
+            exit(1);
+        }
+        buf = bigger;
+        run->live += step_size;
+        size += step_size;
+        pins[i] = frag_malloc(run, 16);
+        if (i % 4 == 3) {
+            sample(run);
+        }
+    }
+    frag_free(run, buf, size);
+    for (i = 0; i < steps; i++) {
+        frag_free(run, pins[i], 16);
+    }
+    free(pins);
+}
+
+static const fragbench_t benches[] = {
+    {"sawtooth", sawtooth_run},
+    {"pinning", pinning_run},
+    {"straddle", straddle_run},
+    {"realloc", realloc_run},
+};
+
+static const size_t nbenches = sizeof(benches) / sizeof(benches[0]);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Driver
+ * ---------------------------------------------------------------------------
+ */
+
+static double ratio(size_t heap, size_t live) {
+    return (live > 0) ? (double)heap / (double)live : 0;
+}
+
+static void run_bench(const fragbench_t *bench,
+                      const bench_allocator_t *alloc, size_t scale,
+                      bool quiet) {
+    static frag_run_t run;
+    size_t peak_live = 0;
+    size_t peak_heap = 0;
+    double worst = 0;
+    size_t i;
+    memset(&run, 0, sizeof(run));
+    run.alloc = alloc;
+    alloc->reset();
+    bench->run(&run, scale);
+    for (i = 0; i < run.nsamples; i++) {
+        sample_t *s = &run.samples[i];
+        double r = ratio(s->heap, s->live);
+        if (s->live > peak_live) {
+            peak_live = s->live;
+        }
+        if (s->heap > peak_heap) {
+            peak_heap = s->heap;
+        }
+        if (r > worst) {
+            worst = r;
+        }
+        if (!quiet) {
+            printf("  %-10s %-5s %7zu %12zu %12zu %8.2f\n", bench->name,
+                   alloc->name, i, s->live / 1024, s->heap / 1024, r);
+        }
+    }
+    printf("%-10s %-5s peak live %zu KB, peak heap %zu KB, "
+           "peak heap / peak live %.2f, worst heap / live %.2f\n",
+           bench->name, alloc->name, peak_live / 1024, peak_heap / 1024,
+           ratio(peak_heap, peak_live), worst);
+}
+
+static void usage(const char *prog) {
+    size_t i;
+    fprintf(stderr,
+            "usage: %s [-s scale] [-a mm|libc|both] [-q] [workload...]\n"
+            "workloads:",
+            prog);
+    for (i = 0; i < nbenches; i++) {
+        fprintf(stderr, " %s", benches[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const bench_allocator_t *allocs[2] = {&bench_mm, &bench_libc};
+    int nallocs = 2;
+    long scale = 1;
+    bool quiet = false;
+    int opt;
+    size_t i;
+    int j, k;
+
+    while ((opt = getopt(argc, argv, "s:a:q")) != -1) {
+        if (opt == 's') {
+            scale = atol(optarg);
+        } else if (opt == 'q') {
+            quiet = true;
+        } else if (opt == 'a' && strcmp(optarg, "both") != 0) {
+            if ((allocs[0] = bench_find_allocator(optarg)) == NULL) {
+                usage(argv[0]);
+            }
+            nallocs = 1;
+        } else if (opt != 'a') {
+            usage(argv[0]);
+        }
+    }
+    if (scale < 1) {
+        usage(argv[0]);
+    }
+    for (k = optind; k < argc; k++) {
+        for (i = 0; i < nbenches && strcmp(argv[k], benches[i].name); i++) {
+        }
+        if (i == nbenches) {
+            usage(argv[0]);
+        }
+    }
+
+    if (!quiet) {
+        printf("  %-10s %-5s %7s %12s %12s %8s\n", "workload", "alloc",
+               "sample", "live KB", "heap KB", "heap/live");
+    }
+    for (i = 0; i < nbenches; i++) {
+        bool selected = (optind == argc);
+        for (k = optind; k < argc; k++) {
+            selected = selected || strcmp(argv[k], benches[i].name) == 0;
+        }
+        for (j = 0; selected && j < nallocs; j++) {
+            pid_t pid;
+            fflush(stdout);
+            if ((pid = fork()) == 0) {
+                run_bench(&benches[i], allocs[j], (size_t)scale, quiet);
+                fflush(stdout);
+                _exit(0);
+            }
+            if (pid < 0 || waitpid(pid, NULL, 0) < 0) {
+                perror("fork");
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,391 @@
+/**
+ * @file mm_microbench.c
+ * @brief Microbenchmarks for the hot paths of mm.c
+ *
+ * Usage:
+ *   mm_microbench [-r runs] [-s scale] [-a mm|libc|both] [-P] [bench...]
+ *
+ * Each benchmark has an untimed setup, a timed kernel and an untimed
+ * teardown, and is run `runs` times. The tool reports ns per allocator
+ * call (mean and standard deviation over the runs) and, unless -P is
+ * given or the kernel forbids perf events, the hardware events of the
+ * timed kernels per call.
+ *
+ *   fixed      malloc(64) + free in a loop: the find_fit fast path
+ *   churn      replace random blocks of a 4096-block pool with blocks of
+ *              random size: find_fit, split_block and coalesce_block
+ *   realloc    grow one block from 16 bytes to 1 MB by doubling
+ *   calloc     calloc + free of 256 KB blocks: extend_heap and zeroing
+ *   freestorm  free 64K adjacent blocks, odd ones first, so that every
+ *              even free coalesces with both neighbours
+ *   bin14      malloc a block just larger than each of 512 free 64 KB
+ *              blocks, so that find_fit walks all of bin 14 and misses
+ *
+ * Build: cc -O2 -DDRIVER -o mm_microbench mm_microbench.c mm_bench.c \
+ *            mm.c memlib.c -lm
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_bench.h"
+
+/** @brief Blocks in the churn pool */
+#define CHURN_SLOTS 4096
+
+/** @brief Blocks freed by one freestorm run */
+#define STORM_BLOCKS 65536
+
+/** @brief Free 64 KB blocks lined up in bin 14 */
+#define SCAN_BLOCKS 512
+
+/** @brief One benchmark: setup and teardown are not timed */
+typedef struct microbench {
+    const char *name;
+    void (*setup)(const bench_allocator_t *alloc, size_t scale);
+    size_t (*run)(const bench_allocator_t *alloc, size_t scale);
+    void (*teardown)(const bench_allocator_t *alloc, size_t scale);
+} microbench_t;
+
+/* State shared between the setup, run and teardown of one benchmark */
+static void *slots[STORM_BLOCKS];
+static uint32_t *picks;  // pre-drawn random slot numbers
+static uint32_t *sizes;  // pre-drawn random sizes
+static size_t nslots;
+
+/**
+ * xorshift32, so that no rand() call lands in a timed loop
+ */
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+/**
+ * a size from the churn mix: mostly small, one in eight up to 8 KB
+ */
+static uint32_t churn_size(uint32_t *state) {
+    uint32_t r = next_random(state);
+    return (r % 8 == 0) ? 16 + r % 8192 : 16 + r % 496;
+}
+
+static void touch(void *ptr) {
+    *(volatile char *)ptr = 1;
+}
+
+/**
+ * stop if the allocator under test ran out of memory; returns `ptr`
+ */
+static void *checked(void *ptr) {
+    if (ptr == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void nothing(const bench_allocator_t *alloc, size_t scale) {
+    (void)alloc;
+    (void)scale;
+}
+
+static void fresh_heap(const bench_allocator_t *alloc, size_t scale) {
+    (void)scale;
+    alloc->reset();
+}
+
+static void free_slots(const bench_allocator_t *alloc, size_t scale) {
+    size_t i;
+    (void)scale;
+    for (i = 0; i < nslots; i++) {
+        alloc->free(slots[i]);
+        slots[i] = NULL;
+    }
+    nslots = 0;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        The benchmarks
+ * ---------------------------------------------------------------------------
+ */
+
+static size_t fixed_run(const bench_allocator_t *alloc, size_t scale) {
+    size_t n = scale << 20;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        void *p = checked(alloc->malloc(64));
+        touch(p);
+        alloc->free(p);
+    }
+    return 2 * n;
+}
+
+static void churn_setup(const bench_allocator_t *alloc, size_t scale) {
+    size_t n = scale << 20;
+    uint32_t state = 42;
+    size_t i;
+    alloc->reset();
+    picks = malloc(n * sizeof(*picks));
+    sizes = malloc(n * sizeof(*sizes));
+    if (picks == NULL || sizes == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {
+        picks[i] = next_random(&state) % CHURN_SLOTS;
+        sizes[i] = churn_size(&state);
+    }
+    for (nslots = 0; nslots < CHURN_SLOTS; nslots++) {
+        slots[nslots] = alloc->malloc(churn_size(&state));
+    }
+}
+
+static size_t churn_run(const bench_allocator_t *alloc, size_t scale) {
+    size_t n = scale << 20;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        void **slot = &slots[picks[i]];
+        alloc->free(*slot);
+        *slot = checked(alloc->malloc(sizes[i]));
+        touch(*slot);
+    }
+    return 2 * n;
+}
+
+static void churn_teardown(const bench_allocator_t *alloc, size_t scale) {
+    free_slots(alloc, scale);
+    free(picks);
+    free(sizes);
+}
+
+static size_t realloc_run(const bench_allocator_t *alloc, size_t scale) {
+    size_t rounds = scale << 8;
+    size_t ops = 0;
+    size_t i, size;
+    for (i = 0; i < rounds; i++) {
+        void *p = checked(alloc->malloc(16));
+        for (size = 32; size <= (1 << 20); size *= 2) {
+            p = checked(alloc->realloc(p, size));
+            touch((char *)p + size - 1);
+            ops++;
+        }
+        alloc->free(p);
+        ops += 2;
+    }
+    return ops;
+}
+
+static size_t calloc_run(const bench_allocator_t *alloc, size_t scale) {
+    size_t n = scale << 10;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        void *p = alloc->calloc(1, 256 << 10);
+        alloc->free(p);
+    }
+    return 2 * n;
+}
+
+static void storm_setup(const bench_allocator_t *alloc, size_t scale) {
+    uint32_t state = 7;
+    (void)scale;
+    alloc->reset();
+    for (nslots = 0; nslots < STORM_BLOCKS; nslots++) {
+        slots[nslots] = alloc->malloc(16 + next_random(&state) % 240);
+    }
+}
+
+static size_t storm_run(const bench_allocator_t *alloc, size_t scale) {
+    size_t i;
+    (void)scale;
+    for (i = 1; i < nslots; i += 2) {
+        alloc->free(slots[i]);
+    }
+    for (i = 0; i < nslots; i += 2) {
+        alloc->free(slots[i]);
+    }
+    i = nslots;
+    nslots = 0;
+    return i;
+}
+
+/*
+ * A 65528-byte request needs a 65536-byte block, the smallest bin-14 size.
+ * Freeing such blocks between 16-byte separators leaves SCAN_BLOCKS of
+ * them in bin 14, none of which fits a 65536-byte request.
+ */
+static void scan_setup(const bench_allocator_t *alloc, size_t scale) {
+    void *big[SCAN_BLOCKS];
+    size_t i;
+    (void)scale;
+    alloc->reset();
+    nslots = 0;
+    for (i = 0; i < SCAN_BLOCKS; i++) {
+        big[i] = alloc->malloc(65528);
+        slots[nslots++] = alloc->malloc(16);
+    }
+    for (i = 0; i < SCAN_BLOCKS; i++) {
+        alloc->free(big[i]);
+    }
+}
+
+static size_t scan_run(const bench_allocator_t *alloc, size_t scale) {
+    size_t n = scale << 8;
+    size_t i;
+    // Every block stays in slots, which SCAN_BLOCKS of them already use
+    if (n > STORM_BLOCKS - nslots) {
+        n = STORM_BLOCKS - nslots;
+    }
+    for (i = 0; i < n; i++) {
+        slots[nslots++] = checked(alloc->malloc(65536));
+    }
+    return n;
+}
+
+static const microbench_t benches[] = {
+    {"fixed", fresh_heap, fixed_run, nothing},
+    {"churn", churn_setup, churn_run, churn_teardown},
+    {"realloc", fresh_heap, realloc_run, nothing},
+    {"calloc", fresh_heap, calloc_run, nothing},
+    {"freestorm", storm_setup, storm_run, nothing},
+    {"bin14", scan_setup, scan_run, free_slots},
+};
+
+static const size_t nbenches = sizeof(benches) / sizeof(benches[0]);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Driver
+ * ---------------------------------------------------------------------------
+ */
+
+static void run_bench(const microbench_t *bench,
+                      const bench_allocator_t *alloc, int runs,
+                      size_t scale, bench_counters_t *counters) {
+    double *ns_per_op = calloc((size_t)runs, sizeof(double));
+    bench_counters_t total;
+    bench_summary_t time;
+    double total_ops = 0;
+    size_t ops = 0;
+    int i, e;
+    if (ns_per_op == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < runs; i++) {
+        double start;
+        bench->setup(alloc, scale);
+        if (counters != NULL) {
+            bench_counters_start(counters);
+        }
+        start = bench_now_ns();
+        ops = bench->run(alloc, scale);
+        ns_per_op[i] = (bench_now_ns() - start) / (double)ops;
+        if (counters != NULL) {
+            bench_counters_stop(counters);
+            for (e = 0; e < BENCH_NUM_EVENTS; e++) {
+                total.fd[e] = counters->fd[e];
+                total.value[e] += counters->value[e];
+            }
+        }
+        total_ops += (double)ops;
+        bench->teardown(alloc, scale);
+    }
+    bench_summarize(ns_per_op, (size_t)runs, &time);
+    printf("%-10s %-5s %10zu %10.1f %8.1f", bench->name, alloc->name, ops,
+           time.mean, time.stddev);
+    if (counters != NULL) {
+        bench_counters_print(stdout, &total, total_ops);
+    }
+    printf("\n");
+    free(ns_per_op);
+}
+
+static void usage(const char *prog) {
+    size_t i;
+    fprintf(stderr,
+            "usage: %s [-r runs] [-s scale] [-a mm|libc|both] [-P] "
+            "[bench...]\n"
+            "benchmarks:",
+            prog);
+    for (i = 0; i < nbenches; i++) {
+        fprintf(stderr, " %s", benches[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const bench_allocator_t *allocs[2] = {&bench_mm, &bench_libc};
+    int nallocs = 2;
+    int runs = 5;
+    long scale = 1;
+    bench_counters_t counters;
+    bool use_counters = true;
+    int opt;
+    size_t i;
+    int j, k;
+
+    while ((opt = getopt(argc, argv, "r:s:a:P")) != -1) {
+        if (opt == 'P') {
+            use_counters = false;
+        } else if (opt == 'r') {
+            runs = atoi(optarg);
+        } else if (opt == 's') {
+            scale = atol(optarg);
+        } else if (opt == 'a' && strcmp(optarg, "both") != 0) {
+            if ((allocs[0] = bench_find_allocator(optarg)) == NULL) {
+                usage(argv[0]);
+            }
+            nallocs = 1;
+        } else if (opt != 'a') {
+            usage(argv[0]);
+        }
+    }
+    if (runs < 1 || scale < 1) {
+        usage(argv[0]);
+    }
+    for (k = optind; k < argc; k++) {
+        for (i = 0; i < nbenches && strcmp(argv[k], benches[i].name); i++) {
+        }
+        if (i == nbenches) {
+            usage(argv[0]);
+        }
+    }
+
+    if (use_counters && bench_counters_open(&counters, false) == 0) {
+        fprintf(stderr, "hardware counters unavailable; reporting time "
+                        "only\n");
+        use_counters = false;
+    }
+    printf("%-10s %-5s %10s %10s %8s", "bench", "alloc", "ops/run", "ns/op",
+           "sd");
+    if (use_counters) {
+        bench_counters_print_header(stdout);
+    }
+    printf("\n");
+    for (i = 0; i < nbenches; i++) {
+        bool selected = (optind == argc);
+        for (k = optind; k < argc; k++) {
+            selected = selected || strcmp(argv[k], benches[i].name) == 0;
+        }
+        for (j = 0; selected && j < nallocs; j++) {
+            run_bench(&benches[i], allocs[j], runs, (size_t)scale,
+                      use_counters ? &counters : NULL);
+        }
+    }
+    if (use_counters) {
+        bench_counters_close(&counters);
+    }
+    return 0;
+}
@@ -0,0 +1,467 @@
+/**
+ * @file mm_mtbench.c
+ * @brief Multithreaded scalability benchmarks
+ *
+ * Usage:
+ *   mm_mtbench [-t max_threads] [-s scale] [-a mm|libc|both] [-P] [bench...]
+ *
+ * Every benchmark runs at 1, 2, 4, ... up to max_threads threads (and at
+ * max_threads itself). Work per thread is fixed, so ideal scaling keeps
+ * ops/sec growing linearly. For each thread count the tool reports total
+ * ops/sec, the speedup over one thread, the parallel efficiency and the
+ * resident set size after the run. Unless -P is given, hardware events
+ * of all benchmark threads are counted too and printed per allocator call;
+ * growing cache misses per call as threads are added point at false
+ * sharing or lock-line bouncing.
+ *
+ *   larson     server churn: each thread replaces random blocks in its own
+ *              pool; after every round the pools rotate to the next thread,
+ *              so blocks are freed by threads that did not allocate them
+ *   threadtest each thread allocates a batch of small blocks and frees it
+ *   prodcons   threads pair up; producers malloc and hand blocks over a
+ *              ring to consumers, which free them
+ *   scratch    cache-scratch: the main thread allocates one small object
+ *              per thread, each thread frees it and then repeatedly
+ *              allocates, writes and frees a small object of its own;
+ *              an allocator that hands neighbouring objects to different
+ *              threads makes them share cache lines
+ *
+ * mm.c is only safe to call from several threads when it is compiled with
+ * -DMM_THREADSAFE; pass the same flag when building this tool. Without it
+ * the tool serializes every mm call behind its own mutex (reported as
+ * "mm*"), which still gives a baseline curve to compare against. With it,
+ * mm rows also report the share of mm's lock acquisitions that found the
+ * lock held and the time spent waiting for it per allocator call.
+ *
+ * Build: cc -O2 -pthread -DDRIVER -o mm_mtbench mm_mtbench.c mm_bench.c \
+ *            mm.c memlib.c -lm
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_bench.h"
+#include "mm_ext.h"
+
+/** @brief Upper bound on the thread count */
+#define MAX_THREADS 256
+
+/** @brief Blocks per larson pool */
+#define LARSON_SLOTS 1024
+
+/** @brief Blocks per threadtest batch */
+#define BATCH 1000
+
+/** @brief Slots in each producer/consumer ring (a power of two) */
+#define RING_SIZE 1024
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Allocator under test
+ * ---------------------------------------------------------------------------
+ */
+
+#ifndef MM_THREADSAFE
+/* mm.c is single-threaded: serialize every call */
+static pthread_mutex_t mm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *locked_malloc(size_t size) {
+    void *p;
+    pthread_mutex_lock(&mm_lock);
+    p = bench_mm.malloc(size);
+    pthread_mutex_unlock(&mm_lock);
+    return p;
+}
+
+static void locked_free(void *ptr) {
+    pthread_mutex_lock(&mm_lock);
+    bench_mm.free(ptr);
+    pthread_mutex_unlock(&mm_lock);
+}
+
+static const bench_allocator_t *mm_allocator(void) {
+    static bench_allocator_t locked;
+    locked = bench_mm;
+    locked.name = "mm*"; // * marks serialized calls
+    locked.malloc = locked_malloc;
+    locked.free = locked_free;
+    return &locked;
+}
+#else
+static const bench_allocator_t *mm_allocator(void) {
+    return &bench_mm;
+}
+#endif
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Benchmarks
+ * ---------------------------------------------------------------------------
+ */
+
+/** @brief What a benchmark thread gets */
+typedef struct worker {
+    const bench_allocator_t *alloc;
+    int index;
+    int nthreads;
+    size_t scale;
+    uint64_t ops; // allocator calls made, filled in by the thread
+} worker_t;
+
+typedef struct mtbench {
+    const char *name;
+    void (*setup)(const bench_allocator_t *alloc, int nthreads);
+    void *(*thread)(void *arg); // takes a worker_t
+    void (*teardown)(const bench_allocator_t *alloc, int nthreads);
+} mtbench_t;
+
+static pthread_barrier_t round_barrier;
+
+static uint32_t next_random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void nothing(const bench_allocator_t *alloc, int nthreads) {
+    (void)alloc;
+    (void)nthreads;
+}
+
+/* larson: pools[i] is worked on by thread (i + round) % nthreads */
+static void **pools[MAX_THREADS];
+
+static void larson_setup(const bench_allocator_t *alloc, int nthreads) {
+    int i, j;
+    pthread_barrier_init(&round_barrier, NULL, (unsigned)nthreads);
+    for (i = 0; i < nthreads; i++) {
+        pools[i] = calloc(LARSON_SLOTS, sizeof(void *));
+        for (j = 0; j < LARSON_SLOTS; j++) {
+            pools[i][j] = alloc->malloc(16 + (size_t)(j * 37) % 240);
+        }
+    }
+}
+
+static void *larson_thread(void *arg) {
+    worker_t *w = arg;
+    uint32_t state = 1234567u + (uint32_t)w->index;
+    size_t per_round = w->scale << 14;
+    int round;
+    size_t i;
+    for (round = 0; round < 8; round++) {
+        void **pool = pools[(w->index + round) % w->nthreads];
+        for (i = 0; i < per_round; i++) {
+            uint32_t r = next_random(&state);
+            void **slot = &pool[r % LARSON_SLOTS];
+            w->alloc->free(*slot);
+            *slot = w->alloc->malloc(16 + (r >> 16) % 240);
+            *(volatile char *)*slot = 1;
+        }
+        w->ops += 2 * per_round;
+        pthread_barrier_wait(&round_barrier);
+    }
+    return NULL;
+}
+
+static void larson_teardown(const bench_allocator_t *alloc, int nthreads) {
+    int i, j;
+    for (i = 0; i < nthreads; i++) {
+        for (j = 0; j < LARSON_SLOTS; j++) {
+            alloc->free(pools[i][j]);
+        }
+        free(pools[i]);
+    }
+    pthread_barrier_destroy(&round_barrier);
+}
+
+static void *threadtest_thread(void *arg) {
+    worker_t *w = arg;
+    void *batch[BATCH];
+    size_t rounds = w->scale << 8;
+    size_t r;
+    int i;
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < BATCH; i++) {
+            batch[i] = w->alloc->malloc(64);
+            *(volatile char *)batch[i] = 1;
+        }
+        for (i = 0; i < BATCH; i++) {
+            w->alloc->free(batch[i]);
+        }
+    }
+    w->ops = 2 * rounds * BATCH;
+    return NULL;
+}
+
+/* prodcons: thread 2k produces into rings[k], thread 2k + 1 consumes */
+typedef struct ring {
+    _Atomic uint64_t head;
+    char pad1[56];
+    _Atomic uint64_t tail;
+    char pad2[56];
+    void *slots[RING_SIZE];
+} ring_t;
+
+static ring_t rings[MAX_THREADS / 2 + 1];
+
+static void prodcons_setup(const bench_allocator_t *alloc, int nthreads) {
+    (void)alloc;
+    (void)nthreads;
+    memset(rings, 0, sizeof(rings));
+}
+
+static void *prodcons_thread(void *arg) {
+    worker_t *w = arg;
+    size_t n = w->scale << 18;
+    size_t i;
+    ring_t *ring = &rings[w->index / 2];
+    if (w->nthreads == 1) { // nobody to hand over to
+        for (i = 0; i < n; i++) {
+            w->alloc->free(w->alloc->malloc(16 + i % 240));
+        }
+        w->ops = 2 * n;
+        return NULL;
+    }
+    if (w->index % 2 == 0 && w->index + 1 == w->nthreads) {
+        return NULL; // odd thread count: the last producer has no partner
+    }
+    for (i = 0; i < n; i++) {
+        if (w->index % 2 == 0) {
+            void *p = w->alloc->malloc(16 + i % 240);
+            uint64_t head = atomic_load_explicit(&ring->head,
+                                                 memory_order_relaxed);
+            while (head - atomic_load_explicit(&ring->tail,
+                                               memory_order_acquire) ==
+                   RING_SIZE) {
+                sched_yield(); // the consumer may share our CPU
+            }
+            ring->slots[head % RING_SIZE] = p;
+            atomic_store_explicit(&ring->head, head + 1,
+                                  memory_order_release);
+        } else {
+            uint64_t tail = atomic_load_explicit(&ring->tail,
+                                                 memory_order_relaxed);
+            while (atomic_load_explicit(&ring->head, memory_order_acquire) ==
+                   tail) {
+                sched_yield();
+            }
+            w->alloc->free(ring->slots[tail % RING_SIZE]);
+            atomic_store_explicit(&ring->tail, tail + 1,
+                                  memory_order_release);
+        }
+    }
+    w->ops = n;
+    return NULL;
+}
+
+/* scratch: objects[i] is allocated by the main thread for thread i */
+static void *objects[MAX_THREADS];
+
+static void scratch_setup(const bench_allocator_t *alloc, int nthreads) {
+    int i;
+    for (i = 0; i < nthreads; i++) {
+        objects[i] = alloc->malloc(8);
+    }
+}
+
+static void *scratch_thread(void *arg) {
+    worker_t *w = arg;
+    size_t rounds = w->scale << 14;
+    size_t r;
+    int i;
+    w->alloc->free(objects[w->index]);
+    for (r = 0; r < rounds; r++) {
+        volatile char *p = w->alloc->malloc(8);
+        for (i = 0; i < 64; i++) {
+            p[i % 8] = (char)(p[i % 8] + 1);
+        }
+        w->alloc->free((void *)p);
+    }
+    w->ops = 2 * rounds + 1;
+    return NULL;
+}
+
+static const mtbench_t benches[] = {
+    {"larson", larson_setup, larson_thread, larson_teardown},
+    {"threadtest", nothing, threadtest_thread, nothing},
+    {"prodcons", prodcons_setup, prodcons_thread, nothing},
+    {"scratch", scratch_setup, scratch_thread, nothing},
+};
+
+static const size_t nbenches = sizeof(benches) / sizeof(benches[0]);
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Driver
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * run one benchmark at `nthreads` threads; returns total ops/sec and
+ * stores the number of allocator calls in `total_ops`. Counters, if
+ * given, must have been opened with inheritance so that they follow the
+ * benchmark threads.
+ */
+static double run_once(const mtbench_t *bench, const bench_allocator_t *alloc,
+                       int nthreads, size_t scale, bench_counters_t *counters,
+                       uint64_t *total_ops) {
+    pthread_t threads[MAX_THREADS];
+    worker_t workers[MAX_THREADS];
+    uint64_t ops = 0;
+    double start, elapsed;
+    int i;
+    alloc->reset();
+    bench->setup(alloc, nthreads);
+    mm_lock_stats_reset();
+    if (counters != NULL) {
+        bench_counters_start(counters);
+    }
+    start = bench_now_ns();
+    for (i = 0; i < nthreads; i++) {
+        workers[i] = (worker_t){alloc, i, nthreads, scale, 0};
+        pthread_create(&threads[i], NULL, bench->thread, &workers[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        ops += workers[i].ops;
+    }
+    elapsed = bench_now_ns() - start;
+    if (counters != NULL) {
+        bench_counters_stop(counters);
+    }
+    bench->teardown(alloc, nthreads);
+    *total_ops = ops;
+    return (double)ops / (elapsed / 1e9);
+}
+
+static void run_bench(const mtbench_t *bench, const bench_allocator_t *alloc,
+                      int max_threads, size_t scale,
+                      bench_counters_t *counters) {
+    double base = 0;
+    int n;
+    for (n = 1; n <= max_threads; n = (n * 2 > max_threads && n < max_threads)
+                                           ? max_threads
+                                           : n * 2) {
+        uint64_t ops;
+        double rate = run_once(bench, alloc, n, scale, counters, &ops);
+        if (n == 1) {
+            base = rate;
+        }
+        printf("%-10s %-5s %7d %10.3f %8.2f %6.1f%% %10zu", bench->name,
+               alloc->name, n, rate / 1e6, rate / base,
+               100.0 * rate / base / n, bench_rss_bytes() / 1024);
+#ifdef MM_THREADSAFE
+        if (alloc == &bench_mm) {
+            mm_lock_stats_t lock;
+            mm_lock_stats(&lock);
+            printf(" %8.1f%% %8.1f",
+                   lock.acquisitions == 0 ? 0.0
+                                          : 100.0 * (double)lock.contended /
+                                                (double)lock.acquisitions,
+                   (double)lock.wait_ns / (double)ops);
+        } else {
+            printf(" %9s %8s", "-", "-");
+        }
+#endif
+        if (counters != NULL) {
+            bench_counters_print(stdout, counters, (double)ops);
+        }
+        printf("\n");
+    }
+}
+
+static void usage(const char *prog) {
+    size_t i;
+    fprintf(stderr,
+            "usage: %s [-t max_threads] [-s scale] [-a mm|libc|both] [-P] "
+            "[bench...]\nbenchmarks:",
+            prog);
+    for (i = 0; i < nbenches; i++) {
+        fprintf(stderr, " %s", benches[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const bench_allocator_t *allocs[2];
+    int nallocs = 2;
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    long scale = 1;
+    bench_counters_t counters;
+    bool use_counters = true;
+    int opt;
+    size_t i;
+    int j, k;
+
+    allocs[0] = mm_allocator();
+    allocs[1] = &bench_libc;
+    while ((opt = getopt(argc, argv, "t:s:a:P")) != -1) {
+        if (opt == 'P') {
+            use_counters = false;
+        } else if (opt == 't') {
+            max_threads = atoi(optarg);
+        } else if (opt == 's') {
+            scale = atol(optarg);
+        } else if (opt == 'a' && strcmp(optarg, "both") != 0) {
+            if (strcmp(optarg, "mm") == 0) {
+                allocs[0] = mm_allocator();
+            } else if ((allocs[0] = bench_find_allocator(optarg)) == NULL) {
+                usage(argv[0]);
+            }
+            nallocs = 1;
+        } else if (opt != 'a') {
+            usage(argv[0]);
+        }
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS || scale < 1) {
+        usage(argv[0]);
+    }
+    for (k = optind; k < argc; k++) {
+        for (i = 0; i < nbenches && strcmp(argv[k], benches[i].name); i++) {
+        }
+        if (i == nbenches) {
+            usage(argv[0]);
+        }
+    }
+
+    if (use_counters && bench_counters_open(&counters, true) == 0) {
+        fprintf(stderr, "hardware counters unavailable; reporting time "
+                        "only\n");
+        use_counters = false;
+    }
+    printf("%-10s %-5s %7s %10s %8s %7s %10s", "bench", "alloc", "threads",
+           "Mops/s", "speedup", "eff", "rss KB");
+#ifdef MM_THREADSAFE
+    printf(" %9s %8s", "contended", "wait ns");
+#endif
+    if (use_counters) {
+        bench_counters_print_header(stdout);
+    }
+    printf("\n");
+    for (i = 0; i < nbenches; i++) {
+        bool selected = (optind == argc);
+        for (k = optind; k < argc; k++) {
+            selected = selected || strcmp(argv[k], benches[i].name) == 0;
+        }
+        for (j = 0; selected && j < nallocs; j++) {
+            run_bench(&benches[i], allocs[j], max_threads, (size_t)scale,
+                      use_counters ? &counters : NULL);
+        }
+    }
+    if (use_counters) {
+        bench_counters_close(&counters);
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file mm_new.cpp
+ * @brief Replacement global operator new and delete
+ *
+ * Linking this file into a C++ program sends every new and delete
+ * expression to the allocator, with no source changes:
+ *
+ *   - operator new and new[] call malloc, and the align_val_t forms call
+ *     mm_aligned_alloc with the requested alignment.
+ *   - the sized delete forms call mm_free_sized, so the size class is
+ *     taken from the size the compiler passes rather than from the block
+ *     header; the unsized ones call free.
+ *   - as the standard requires, a failed allocation calls the installed
+ *     new_handler and retries until the handler gives up, after which the
+ *     throwing forms throw std::bad_alloc and the nothrow forms return
+ *     nullptr. A zero-byte request gets a distinct one-byte block.
+ *
+ * Build: c++ -O2 -c mm_new.cpp, with -DDRIVER if and only if mm.c was
+ * built with it; C++17 or later.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <cstddef>
+#include <new>
+
+#include "mm_ext.h"
+
+extern "C" {
+#include "mm.h"
+}
+
+namespace {
+
+/**
+ * @brief Allocates `size` bytes aligned to `align`, calling the new_handler
+ *        until it succeeds.
+ * @return nullptr once there is no new_handler left to call
+ */
+void *allocate(std::size_t size, std::size_t align) {
+    if (size == 0) {
+        size = 1;
+    }
+    for (;;) {
+        void *p = align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__
+                      ? malloc(size)
+                      : mm_aligned_alloc(align, size);
+        if (p != nullptr) {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            return nullptr;
+        }
+        handler();
+    }
+}
+
+void *allocate_or_throw(std::size_t size, std::size_t align) {
+    void *p = allocate(size, align);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *allocate_or_null(std::size_t size, std::size_t align) noexcept {
+    try {
+        return allocate(size, align);
+    } catch (const std::bad_alloc &) {
+        // thrown by the new_handler
+        return nullptr;
+    }
+}
+
+} // namespace
+
+/*
+ * ---------------------------------------------------------------------------
+ *                                operator new
+ * ---------------------------------------------------------------------------
+ */
+
+void *operator new(std::size_t size) {
+    return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](std::size_t size) {
+    return allocate_or_throw(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate_or_null(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate_or_null(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+    return allocate_or_throw(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align) {
+    return allocate_or_throw(size, static_cast<std::size_t>(align));
+}
+
+void *operator new(std::size_t size, std::align_val_t align,
+                   const std::nothrow_t &) noexcept {
+    return allocate_or_null(size, static_cast<std::size_t>(align));
+}
+
+void *operator new[](std::size_t size, std::align_val_t align,
+                     const std::nothrow_t &) noexcept {
+    return allocate_or_null(size, static_cast<std::size_t>(align));
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                               operator delete
+ * ---------------------------------------------------------------------------
+ */
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::size_t size) noexcept {
+    mm_free_sized(p, size);
+}
+
+void operator delete[](void *p, std::size_t size) noexcept {
+    mm_free_sized(p, size);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, std::size_t size, std::align_val_t) noexcept {
+    mm_free_sized(p, size);
+}
+
+void operator delete[](void *p, std::size_t size, std::align_val_t) noexcept {
+    mm_free_sized(p, size);
+}
+
+void operator delete(void *p, std::align_val_t,
+                     const std::nothrow_t &) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p, std::align_val_t,
+                       const std::nothrow_t &) noexcept {
+    free(p);
+}
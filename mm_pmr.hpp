@@ -0,0 +1,125 @@
+/**
+ * @file mm_pmr.hpp
+ * @brief std::pmr::memory_resource adapters for the allocator
+ *
+ * mm::resource allocates every block from the heap, forwarding the
+ * requested alignment to mm_aligned_alloc and the size to mm_free_sized.
+ * mm::monotonic_resource bump-allocates from an mm_arena_t and frees
+ * everything at once in release() or its destructor, like
+ * std::pmr::monotonic_buffer_resource.
+ *
+ *   mm::monotonic_resource arena;
+ *   std::pmr::vector<int> v(&arena);
+ *   std::pmr::map<int, int> m(mm::resource::get());
+ *
+ * Build: compile mm.c as C and link it in; C++17 or later.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#ifndef MM_PMR_HPP
+#define MM_PMR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+
+#include "mm_ext.h"
+
+namespace mm {
+
+/**
+ * @brief A memory resource backed by the allocator's heap.
+ *
+ * All instances allocate from the same heap, so any of them can free
+ * what another allocated and they compare equal.
+ */
+class resource : public std::pmr::memory_resource {
+  public:
+    /** @brief Returns a process-wide instance */
+    static resource *get() noexcept {
+        static resource instance;
+        return &instance;
+    }
+
+  protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        void *p = mm_aligned_alloc(alignment, bytes == 0 ? 1 : bytes);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes,
+                       std::size_t /* alignment */) override {
+        mm_free_sized(p, bytes);
+    }
+
+    bool do_is_equal(
+        const std::pmr::memory_resource &other) const noexcept override {
+        return dynamic_cast<const resource *>(&other) != nullptr;
+    }
+};
+
+/**
+ * @brief A memory resource that bump-allocates from an arena and frees
+ *        nothing until release() or destruction.
+ */
+class monotonic_resource : public std::pmr::memory_resource {
+  public:
+    /**
+     * @param chunk_size Bytes the arena takes from the heap at a time, 0
+     *                   for the default
+     */
+    explicit monotonic_resource(std::size_t chunk_size = 0)
+        : arena_(mm_arena_create(chunk_size)) {
+        if (arena_ == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+
+    monotonic_resource(const monotonic_resource &) = delete;
+    monotonic_resource &operator=(const monotonic_resource &) = delete;
+
+    ~monotonic_resource() override {
+        mm_arena_destroy(arena_);
+    }
+
+    /** @brief Frees everything allocated so far (mm_arena_reset) */
+    void release() noexcept {
+        mm_arena_reset(arena_);
+    }
+
+  protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        // The arena aligns to 16; ask for more when that is not enough
+        std::size_t extra = alignment > 16 ? alignment - 16 : 0;
+        if (bytes > SIZE_MAX - extra - 1) {
+            throw std::bad_alloc();
+        }
+        void *p = mm_arena_alloc(arena_, (bytes == 0 ? 1 : bytes) + extra);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(p);
+        addr = (addr + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+        return reinterpret_cast<void *>(addr);
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {
+    }
+
+    bool do_is_equal(
+        const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+  private:
+    mm_arena_t *arena_;
+};
+
+} // namespace mm
+
+#endif /* MM_PMR_HPP */
@@ -0,0 +1,334 @@
+/**
+ * @file mm_replay.c
+ * @brief Replays allocation traces and reports throughput and utilization
+ *
+ * Usage:
+ *   mm_replay [-n iterations] [-w warmups] [-a mm|libc|both] [-P] trace...
+ *
+ * Each trace may be a driver text trace or a binary trace recorded with
+ * mm_trace_start(). For every trace and allocator the tool first replays
+ * the trace once, untimed, to measure memory use:
+ *
+ *   util      peak live payload / heap size at the end of the trace
+ *   int-frag  1 - live payload / usable bytes of the live blocks, at the
+ *             point of peak payload (padding and rounding only)
+ *   ext-free  free bytes inside the heap / heap size, at the same point
+ *   ext-frag  1 - largest free extent / free bytes, at the same point
+ *             (mm only: the C library does not report its largest extent)
+ *   heap      heap size at the end of the trace
+ *   growth    heap size after the last timed run minus after the first;
+ *             nonzero when memory is retained across runs
+ *
+ * Then it runs `warmups` untimed and `iterations` timed replays, each from
+ * an empty heap where the allocator allows it, and reports the mean,
+ * standard deviation and range of the throughput. Unless -P is given, it
+ * also counts hardware events over the timed replays and prints them per
+ * trace operation (see bench_counters_print()).
+ *
+ * Build: cc -O2 -DDRIVER -o mm_replay mm_replay.c mm_bench.c mm_trace.c \
+ *            mm.c memlib.c -lm
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_bench.h"
+#include "mm_trace.h"
+
+/** @brief A loaded trace */
+typedef struct trace {
+    const char *path;
+    mm_trace_op_t *ops;
+    size_t nops;
+    uint64_t nids;
+    void **blocks;  // live pointer of each id
+    size_t *sizes;  // requested size of each id
+} trace_t;
+
+/** @brief What the untimed measuring replay found */
+typedef struct footprint {
+    size_t peak_payload;
+    size_t peak_usable; // usable bytes of the live blocks at peak payload
+    size_t peak_free;   // free bytes in the heap at peak payload
+    size_t peak_largest;
+    size_t heap_size;   // at the end of the trace
+} footprint_t;
+
+/**
+ * write to the first and last byte of a new block, so that both
+ * allocators pay for touching the memory they hand out
+ */
+static void touch(void *ptr, size_t size) {
+    if (size > 0) {
+        ((volatile char *)ptr)[0] = 1;
+        ((volatile char *)ptr)[size - 1] = 1;
+    }
+}
+
+/**
+ * run the first `limit` operations of the trace; returns false if an
+ * allocation fails. If `fp` is given, track the live payload as we go.
+ */
+static bool run_ops(const bench_allocator_t *alloc, trace_t *trace,
+                    size_t limit, footprint_t *fp, size_t *peak_index) {
+    size_t i;
+    size_t payload = 0;
+    size_t usable = 0;
+    for (i = 0; i < limit; i++) {
+        mm_trace_op_t *op = &trace->ops[i];
+        void **slot = &trace->blocks[op->id];
+        if (fp != NULL && *slot != NULL) {
+            payload -= trace->sizes[op->id];
+            usable -= alloc->usable_size(*slot);
+        }
+        if (op->kind == 'a') {
+            *slot = alloc->malloc(op->size);
+        } else if (op->kind == 'c') {
+            *slot = alloc->calloc(1, op->size);
+        } else if (op->kind == 'r') {
+            *slot = alloc->realloc(*slot, op->size);
+        } else {
+            alloc->free(*slot);
+            *slot = NULL;
+            continue;
+        }
+        if (*slot == NULL && op->size != 0) {
+            fprintf(stderr, "%s: %s: allocation %zu of %" PRIu64
+                            " bytes failed\n",
+                    trace->path, alloc->name, i, op->size);
+            return false;
+        }
+        touch(*slot, op->size);
+        trace->sizes[op->id] = op->size;
+        if (fp != NULL) {
+            payload += op->size;
+            usable += alloc->usable_size(*slot);
+            if (payload > fp->peak_payload) {
+                fp->peak_payload = payload;
+                fp->peak_usable = usable;
+                *peak_index = i + 1;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * free whatever the trace left allocated
+ */
+static void release_all(const bench_allocator_t *alloc, trace_t *trace) {
+    uint64_t id;
+    for (id = 0; id < trace->nids; id++) {
+        if (trace->blocks[id] != NULL) {
+            alloc->free(trace->blocks[id]);
+            trace->blocks[id] = NULL;
+        }
+    }
+}
+
+/**
+ * replay untimed twice: once to find the peak and the final heap size,
+ * once more up to the peak to look at the free space there
+ */
+static bool measure(const bench_allocator_t *alloc, trace_t *trace,
+                    footprint_t *fp) {
+    size_t peak_index = 0;
+    size_t unused;
+    memset(fp, 0, sizeof(*fp));
+    alloc->reset();
+    if (!run_ops(alloc, trace, trace->nops, fp, &peak_index)) {
+        release_all(alloc, trace);
+        return false;
+    }
+    fp->heap_size = alloc->heap_size();
+    release_all(alloc, trace);
+
+    alloc->reset();
+    if (!run_ops(alloc, trace, peak_index, NULL, &unused)) {
+        release_all(alloc, trace);
+        return false;
+    }
+    alloc->free_space(&fp->peak_free, &fp->peak_largest);
+    release_all(alloc, trace);
+    return true;
+}
+
+static double percent(double part, double whole) {
+    return (whole > 0) ? 100.0 * part / whole : 0;
+}
+
+/**
+ * measure, warm up, time and report one trace on one allocator
+ */
+static bool replay(const bench_allocator_t *alloc, trace_t *trace,
+                   int iterations, int warmups, bench_counters_t *counters) {
+    bench_counters_t total;
+    footprint_t fp;
+    bench_summary_t summary;
+    double *samples = calloc((size_t)iterations, sizeof(double));
+    size_t first_heap = 0;
+    size_t last_heap = 0;
+    size_t unused;
+    int i;
+    if (samples == NULL || !measure(alloc, trace, &fp)) {
+        free(samples);
+        return false;
+    }
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < warmups + iterations; i++) {
+        bool timed = (i >= warmups);
+        double start, elapsed;
+        int e;
+        alloc->reset();
+        if (timed && counters != NULL) {
+            bench_counters_start(counters);
+        }
+        start = bench_now_ns();
+        if (!run_ops(alloc, trace, trace->nops, NULL, &unused)) {
+            release_all(alloc, trace);
+            free(samples);
+            return false;
+        }
+        elapsed = bench_now_ns() - start;
+        if (timed && counters != NULL) {
+            bench_counters_stop(counters);
+            for (e = 0; e < BENCH_NUM_EVENTS; e++) {
+                total.fd[e] = counters->fd[e];
+                total.value[e] += counters->value[e];
+            }
+        }
+        release_all(alloc, trace);
+        if (timed) {
+            samples[i - warmups] = (double)trace->nops / (elapsed / 1e9);
+            last_heap = alloc->heap_size();
+            if (i == warmups) {
+                first_heap = last_heap;
+            }
+        }
+    }
+    bench_summarize(samples, (size_t)iterations, &summary);
+    printf("%-24s %-5s %9zu %9.3f %7.3f %5.1f%% %9.3f %9.3f %6.1f%% "
+           "%6.1f%% %6.1f%% ",
+           trace->path, alloc->name, trace->nops, summary.mean / 1e6,
+           summary.stddev / 1e6, percent(summary.stddev, summary.mean),
+           summary.min / 1e6, summary.max / 1e6,
+           percent((double)fp.peak_payload, (double)fp.heap_size),
+           percent((double)(fp.peak_usable - fp.peak_payload),
+                   (double)fp.peak_usable),
+           percent((double)fp.peak_free, (double)fp.heap_size));
+    if (fp.peak_largest > 0) {
+        printf("%6.1f%% ", 100.0 - percent((double)fp.peak_largest,
+                                           (double)fp.peak_free));
+    } else {
+        printf("%7s ", "-");
+    }
+    printf("%9zu %+9ld", fp.heap_size / 1024,
+           ((long)last_heap - (long)first_heap) / 1024);
+    if (counters != NULL) {
+        bench_counters_print(stdout, &total,
+                             (double)trace->nops * iterations);
+    }
+    printf("\n");
+    free(samples);
+    return true;
+}
+
+static bool load_trace(const char *path, trace_t *trace) {
+    memset(trace, 0, sizeof(*trace));
+    trace->path = path;
+    trace->ops = mm_trace_load_ops(path, &trace->nops, &trace->nids);
+    if (trace->ops == NULL) {
+        fprintf(stderr, "%s: cannot load trace\n", path);
+        return false;
+    }
+    trace->blocks = calloc(trace->nids + 1, sizeof(void *));
+    trace->sizes = calloc(trace->nids + 1, sizeof(size_t));
+    return trace->blocks != NULL && trace->sizes != NULL;
+}
+
+static void unload_trace(trace_t *trace) {
+    free(trace->ops);
+    free(trace->blocks);
+    free(trace->sizes);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-n iterations] [-w warmups] [-a mm|libc|both] "
+            "[-P] trace...\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const bench_allocator_t *allocs[2] = {&bench_mm, &bench_libc};
+    int nallocs = 2;
+    int iterations = 10;
+    int warmups = 2;
+    bench_counters_t counters;
+    bool use_counters = true;
+    int status = 0;
+    int opt;
+    int i, j;
+
+    while ((opt = getopt(argc, argv, "n:w:a:P")) != -1) {
+        if (opt == 'P') {
+            use_counters = false;
+        } else if (opt == 'n') {
+            iterations = atoi(optarg);
+        } else if (opt == 'w') {
+            warmups = atoi(optarg);
+        } else if (opt == 'a' && strcmp(optarg, "both") != 0) {
+            if ((allocs[0] = bench_find_allocator(optarg)) == NULL) {
+                usage(argv[0]);
+            }
+            nallocs = 1;
+        } else if (opt != 'a') {
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc || iterations < 1 || warmups < 0) {
+        usage(argv[0]);
+    }
+    if (use_counters && bench_counters_open(&counters, false) == 0) {
+        fprintf(stderr, "hardware counters unavailable; reporting time "
+                        "only\n");
+        use_counters = false;
+    }
+
+    printf("%-24s %-5s %9s %9s %7s %6s %9s %9s %7s %7s %7s %7s %9s %9s\n",
+           "trace", "alloc", "ops", "Mops/s", "sd", "cv", "min", "max",
+           "util", "int", "ext", "ext", "heap", "growth");
+    printf("%-24s %-5s %9s %9s %7s %6s %9s %9s %7s %7s %7s %7s %9s %9s",
+           "", "", "", "mean", "", "", "", "", "", "frag", "free", "frag",
+           "KB", "KB");
+    if (use_counters) {
+        bench_counters_print_header(stdout);
+    }
+    printf("\n");
+    for (i = optind; i < argc; i++) {
+        trace_t trace;
+        if (!load_trace(argv[i], &trace)) {
+            status = 1;
+            continue;
+        }
+        for (j = 0; j < nallocs; j++) {
+            if (!replay(allocs[j], &trace, iterations, warmups,
+                        use_counters ? &counters : NULL)) {
+                status = 1;
+            }
+        }
+        unload_trace(&trace);
+    }
+    if (use_counters) {
+        bench_counters_close(&counters);
+    }
+    return status;
+}
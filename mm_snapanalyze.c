@@ -0,0 +1,339 @@
+/**
+ * @file mm_snapanalyze.c
+ * @brief Offline analysis of heap snapshots written by mm_snapshot()
+ *
+ * Usage:
+ *   mm_snapanalyze [-n largest] [-w width] [-r rows] snapshot
+ *
+ * Prints, for one snapshot:
+ *
+ *   summary    heap size, allocated and free blocks and bytes, and the
+ *              external fragmentation (1 - largest free block / free bytes)
+ *   map        the heap cut into width * rows cells, each drawn by the
+ *              share of its bytes that are free:
+ *                '#' none, '+' under half, '-' half or more, '.' all
+ *   bins       free blocks and bytes per seg_list bin, with the offset of
+ *              each list head
+ *   largest    the `largest` biggest free blocks (the heap is coalesced, so
+ *              these are also the largest free extents)
+ *
+ * Build: cc -O2 -o mm_snapanalyze mm_snapanalyze.c
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_snapshot.h"
+
+/** @brief Most seg_list bins a snapshot may describe */
+#define MAX_BINS 64
+
+/** @brief One decoded block */
+typedef struct snap_block {
+    uint64_t offset;
+    uint64_t size;
+    bool alloc;
+} snap_block_t;
+
+/** @brief A decoded snapshot */
+typedef struct snapshot {
+    uint64_t heap_size;
+    uint64_t nbins;
+    uint64_t bin_min[MAX_BINS];
+    uint64_t head[MAX_BINS]; // offset + 1, 0 for an empty list
+    snap_block_t *blocks;
+    size_t nblocks;
+} snapshot_t;
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Reading
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * read one varint from `*p`, not going past `end`; returns false if the
+ * buffer ends first
+ */
+static bool get_varint(const unsigned char **p, const unsigned char *end,
+                       uint64_t *value) {
+    int shift = 0;
+    *value = 0;
+    while (*p < end && shift < 64) {
+        unsigned char byte = *(*p)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+        shift += 7;
+    }
+    return false;
+}
+
+static unsigned char *read_file(const char *path, size_t *len) {
+    size_t capacity = 1 << 16;
+    unsigned char *data = malloc(capacity);
+    FILE *file = fopen(path, "rb");
+    size_t n;
+    *len = 0;
+    if (file == NULL || data == NULL) {
+        free(data);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return NULL;
+    }
+    while ((n = fread(data + *len, 1, capacity - *len, file)) > 0) {
+        *len += n;
+        if (*len == capacity) {
+            unsigned char *bigger = realloc(data, capacity *= 2);
+            if (bigger == NULL) {
+                free(data);
+                fclose(file);
+                return NULL;
+            }
+            data = bigger;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+static bool load_snapshot(const char *path, snapshot_t *snap) {
+    size_t len;
+    size_t capacity = 1024;
+    uint64_t offset, word, i;
+    unsigned char *data = read_file(path, &len);
+    const unsigned char *p = data;
+    const unsigned char *end = data + len;
+    bool ok;
+
+    memset(snap, 0, sizeof(*snap));
+    if (data == NULL || len < 5 || memcmp(data, MM_SNAPSHOT_MAGIC, 4) != 0 ||
+        data[4] != MM_SNAPSHOT_VERSION) {
+        free(data);
+        return false;
+    }
+    p += 5;
+    ok = get_varint(&p, end, &snap->heap_size) &&
+         get_varint(&p, end, &offset) && get_varint(&p, end, &snap->nbins) &&
+         snap->nbins <= MAX_BINS;
+    for (i = 0; ok && i < snap->nbins; i++) {
+        ok = get_varint(&p, end, &snap->bin_min[i]);
+    }
+    for (i = 0; ok && i < snap->nbins; i++) {
+        ok = get_varint(&p, end, &snap->head[i]);
+    }
+
+    snap->blocks = malloc(capacity * sizeof(snap_block_t));
+    while (ok && snap->blocks != NULL) {
+        if (!(ok = get_varint(&p, end, &word)) || word == 0) {
+            break; // the epilogue
+        }
+        if (snap->nblocks == capacity) {
+            snap_block_t *bigger =
+                realloc(snap->blocks, (capacity *= 2) * sizeof(snap_block_t));
+            if (bigger == NULL) {
+                ok = false;
+                break;
+            }
+            snap->blocks = bigger;
+        }
+        snap->blocks[snap->nblocks].offset = offset;
+        snap->blocks[snap->nblocks].size = (word >> 2) * 16;
+        snap->blocks[snap->nblocks].alloc = (word & 1) != 0;
+        offset += (word >> 2) * 16;
+        snap->nblocks++;
+    }
+    free(data);
+    if (!ok || snap->blocks == NULL) {
+        free(snap->blocks);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Reports
+ * ---------------------------------------------------------------------------
+ */
+
+static int bin_of(const snapshot_t *snap, uint64_t size) {
+    int bin = 0;
+    while ((uint64_t)bin + 1 < snap->nbins && size >= snap->bin_min[bin + 1]) {
+        bin++;
+    }
+    return bin;
+}
+
+static void print_summary(const snapshot_t *snap) {
+    uint64_t alloc_bytes = 0;
+    uint64_t free_bytes = 0;
+    uint64_t largest = 0;
+    size_t alloc_blocks = 0;
+    size_t i;
+    for (i = 0; i < snap->nblocks; i++) {
+        const snap_block_t *b = &snap->blocks[i];
+        if (b->alloc) {
+            alloc_blocks++;
+            alloc_bytes += b->size;
+        } else {
+            free_bytes += b->size;
+            if (b->size > largest) {
+                largest = b->size;
+            }
+        }
+    }
+    printf("heap %" PRIu64 " bytes, %zu blocks\n", snap->heap_size,
+           snap->nblocks);
+    printf("allocated %zu blocks, %" PRIu64 " bytes (%.1f%% of the heap)\n",
+           alloc_blocks, alloc_bytes,
+           snap->heap_size ? 100.0 * (double)alloc_bytes /
+                                 (double)snap->heap_size
+                           : 0);
+    printf("free %zu blocks, %" PRIu64 " bytes, largest %" PRIu64 "\n",
+           snap->nblocks - alloc_blocks, free_bytes, largest);
+    printf("external fragmentation %.1f%%\n\n",
+           free_bytes ? 100.0 * (1 - (double)largest / (double)free_bytes)
+                      : 0);
+}
+
+static void print_map(const snapshot_t *snap, int width, int rows) {
+    size_t ncells = (size_t)width * (size_t)rows;
+    double *free_share = calloc(ncells, sizeof(double));
+    double cell_bytes = (double)snap->heap_size / (double)ncells;
+    size_t i, c;
+    if (free_share == NULL || cell_bytes <= 0) {
+        free(free_share);
+        return;
+    }
+    // spread each free block over the cells it overlaps
+    for (i = 0; i < snap->nblocks; i++) {
+        const snap_block_t *b = &snap->blocks[i];
+        double start = (double)b->offset;
+        double stop = start + (double)b->size;
+        if (b->alloc) {
+            continue;
+        }
+        for (c = (size_t)(start / cell_bytes);
+             c < ncells && (double)c * cell_bytes < stop; c++) {
+            double lo = (double)c * cell_bytes;
+            double hi = lo + cell_bytes;
+            double overlap = ((stop < hi) ? stop : hi) -
+                             ((start > lo) ? start : lo);
+            free_share[c] += overlap / cell_bytes;
+        }
+    }
+    printf("map: %d x %d cells of %.0f bytes ('#' none free, '+' under "
+           "half, '-' half or more, '.' all)\n",
+           width, rows, cell_bytes);
+    for (c = 0; c < ncells; c++) {
+        double f = free_share[c];
+        putchar(f <= 0.001 ? '#' : f < 0.5 ? '+' : f < 0.999 ? '-' : '.');
+        if ((c + 1) % (size_t)width == 0) {
+            putchar('\n');
+        }
+    }
+    putchar('\n');
+    free(free_share);
+}
+
+static void print_bins(const snapshot_t *snap) {
+    size_t count[MAX_BINS] = {0};
+    uint64_t bytes[MAX_BINS] = {0};
+    uint64_t bin;
+    size_t i;
+    for (i = 0; i < snap->nblocks; i++) {
+        if (!snap->blocks[i].alloc) {
+            int b = bin_of(snap, snap->blocks[i].size);
+            count[b]++;
+            bytes[b] += snap->blocks[i].size;
+        }
+    }
+    printf("%4s %10s %10s %14s %14s\n", "bin", "min size", "free", "bytes",
+           "head offset");
+    for (bin = 0; bin < snap->nbins; bin++) {
+        printf("%4" PRIu64 " %10" PRIu64 " %10zu %14" PRIu64, bin,
+               snap->bin_min[bin], count[bin], bytes[bin]);
+        if (snap->head[bin] != 0) {
+            printf(" %14" PRIu64 "\n", snap->head[bin] - 1);
+        } else {
+            printf(" %14s\n", "-");
+        }
+    }
+    putchar('\n');
+}
+
+static int by_size_desc(const void *a, const void *b) {
+    uint64_t x = ((const snap_block_t *)a)->size;
+    uint64_t y = ((const snap_block_t *)b)->size;
+    return (x < y) - (x > y);
+}
+
+static void print_largest(const snapshot_t *snap, size_t n) {
+    snap_block_t *frees = malloc((snap->nblocks + 1) * sizeof(snap_block_t));
+    size_t nfree = 0;
+    size_t i;
+    if (frees == NULL) {
+        return;
+    }
+    for (i = 0; i < snap->nblocks; i++) {
+        if (!snap->blocks[i].alloc) {
+            frees[nfree++] = snap->blocks[i];
+        }
+    }
+    qsort(frees, nfree, sizeof(snap_block_t), by_size_desc);
+    printf("largest free extents:\n%14s %14s %4s\n", "offset", "size", "bin");
+    for (i = 0; i < n && i < nfree; i++) {
+        printf("%14" PRIu64 " %14" PRIu64 " %4d\n", frees[i].offset,
+               frees[i].size, bin_of(snap, frees[i].size));
+    }
+    free(frees);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n largest] [-w width] [-r rows] snapshot\n",
+            prog);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    snapshot_t snap;
+    int largest = 10;
+    int width = 64;
+    int rows = 16;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:r:")) != -1) {
+        if (opt == 'n') {
+            largest = atoi(optarg);
+        } else if (opt == 'w') {
+            width = atoi(optarg);
+        } else if (opt == 'r') {
+            rows = atoi(optarg);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (optind + 1 != argc || largest < 0 || width < 1 || rows < 1) {
+        usage(argv[0]);
+    }
+    if (!load_snapshot(argv[optind], &snap)) {
+        fprintf(stderr, "%s: not a readable snapshot\n", argv[optind]);
+        return 1;
+    }
+    print_summary(&snap);
+    print_map(&snap, width, rows);
+    print_bins(&snap);
+    print_largest(&snap, (size_t)largest);
+    free(snap.blocks);
+    return 0;
+}
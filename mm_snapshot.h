@@ -0,0 +1,30 @@
+/**
+ * @file mm_snapshot.h
+ * @brief Binary heap snapshot format
+ *
+ * mm_snapshot() (see mm_ext.h) writes the layout of the heap in the
+ * format below; mm_snapanalyze reads it. All integers after the magic are
+ * unsigned LEB128 varints.
+ *
+ *   file    := "MMSN" version:u8 header block* 0
+ *   header  := heap_size first nbins bin_min{nbins} head{nbins}
+ *   block   := (size / 16) << 2 | prev_alloc << 1 | alloc
+ *
+ * `first` is the offset of the first block header from the start of the
+ * heap; every following block starts where the previous one ends, so
+ * offsets are not stored. bin_min is the smallest block size of each
+ * seg_list bin, which is enough to find the bin of a free block. `head`
+ * is the offset of the first block of each free list plus one, with 0
+ * for an empty list. The 0 after the last block stands for the epilogue.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#ifndef MM_SNAPSHOT_H
+#define MM_SNAPSHOT_H
+
+/** @brief File magic, followed by MM_SNAPSHOT_VERSION */
+#define MM_SNAPSHOT_MAGIC "MMSN"
+#define MM_SNAPSHOT_VERSION 1
+
+#endif /* MM_SNAPSHOT_H */
@@ -0,0 +1,462 @@
+/**
+ * @file mm_trace.c
+ * @brief Reader and text converter for binary allocation traces
+ *
+ * The format is described in mm_trace.h. Nothing in here depends on the
+ * allocator, so tools link this file against the system malloc.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm_trace.h"
+
+struct mm_trace_reader {
+    FILE *file;
+    // state of the records chunk being decoded
+    uint32_t thread;
+    uint64_t seq;
+    uint64_t time;
+    uint64_t left; // records left in the chunk
+    // first and last clock calibration points
+    uint64_t clock_count;
+    uint64_t ticks0, ns0;
+    uint64_t ticks1, ns1;
+};
+
+/**
+ * read one unsigned LEB128 varint; false on EOF or overlong encoding
+ */
+static bool read_varint(FILE *file, uint64_t *value) {
+    uint64_t result = 0;
+    int shift = 0;
+    int c;
+    do {
+        if (shift > 63 || (c = getc(file)) == EOF) {
+            return false;
+        }
+        result |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    *value = result;
+    return true;
+}
+
+mm_trace_reader_t *mm_trace_open(const char *path) {
+    char magic[4];
+    mm_trace_reader_t *reader;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+        memcmp(magic, MM_TRACE_MAGIC, sizeof(magic)) != 0 ||
+        getc(file) != MM_TRACE_VERSION) {
+        fclose(file);
+        return NULL;
+    }
+    reader = calloc(1, sizeof(*reader));
+    if (reader == NULL) {
+        fclose(file);
+        return NULL;
+    }
+    reader->file = file;
+    return reader;
+}
+
+/**
+ * read the fields of one record whose op byte is `op`
+ */
+static bool read_record(mm_trace_reader_t *reader, int op,
+                        mm_trace_rec_t *rec) {
+    FILE *file = reader->file;
+    uint64_t delta;
+    memset(rec, 0, sizeof(*rec));
+    switch (op) {
+    case MM_OP_MALLOC:
+        if (!read_varint(file, &rec->size) ||
+            !read_varint(file, &rec->result)) {
+            return false;
+        }
+        break;
+    case MM_OP_FREE:
+        if (!read_varint(file, &rec->arg)) {
+            return false;
+        }
+        break;
+    case MM_OP_REALLOC:
+        if (!read_varint(file, &rec->arg) || !read_varint(file, &rec->size) ||
+            !read_varint(file, &rec->result)) {
+            return false;
+        }
+        break;
+    case MM_OP_CALLOC:
+        if (!read_varint(file, &rec->elements) ||
+            !read_varint(file, &rec->size) ||
+            !read_varint(file, &rec->result)) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    if (!read_varint(file, &delta)) {
+        return false;
+    }
+    reader->time += delta;
+    rec->op = (mm_op_t)op;
+    rec->thread = reader->thread;
+    rec->seq = reader->seq++;
+    rec->time = reader->time;
+    return true;
+}
+
+int mm_trace_next(mm_trace_reader_t *reader, mm_trace_rec_t *rec) {
+    uint64_t thread, ticks, ns;
+    int tag;
+    while (reader->left == 0) {
+        if ((tag = getc(reader->file)) == EOF) {
+            return 0;
+        }
+        if (tag == MM_TRACE_CHUNK_RECORDS) {
+            if (!read_varint(reader->file, &thread) ||
+                !read_varint(reader->file, &reader->seq) ||
+                !read_varint(reader->file, &reader->time) ||
+                !read_varint(reader->file, &reader->left)) {
+                return -1;
+            }
+            reader->thread = (uint32_t)thread;
+        } else if (tag == MM_TRACE_CHUNK_CLOCK) {
+            if (!read_varint(reader->file, &ticks) ||
+                !read_varint(reader->file, &ns)) {
+                return -1;
+            }
+            if (reader->clock_count++ == 0) {
+                reader->ticks0 = ticks;
+                reader->ns0 = ns;
+            }
+            reader->ticks1 = ticks;
+            reader->ns1 = ns;
+        } else {
+            return -1;
+        }
+    }
+    reader->left--;
+    return read_record(reader, getc(reader->file), rec) ? 1 : -1;
+}
+
+double mm_trace_ticks_per_ns(const mm_trace_reader_t *reader) {
+    if (reader->clock_count < 2 || reader->ns1 == reader->ns0) {
+        return 0;
+    }
+    return (double)(reader->ticks1 - reader->ticks0) /
+           (double)(reader->ns1 - reader->ns0);
+}
+
+void mm_trace_close(mm_trace_reader_t *reader) {
+    fclose(reader->file);
+    free(reader);
+}
+
+/**
+ * order records by time, then by thread and sequence number
+ */
+static int compare_records(const void *a, const void *b) {
+    const mm_trace_rec_t *x = a;
+    const mm_trace_rec_t *y = b;
+    if (x->time != y->time) {
+        return (x->time < y->time) ? -1 : 1;
+    }
+    if (x->thread != y->thread) {
+        return (x->thread < y->thread) ? -1 : 1;
+    }
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+mm_trace_rec_t *mm_trace_load(const char *path, size_t *count) {
+    size_t used = 0;
+    size_t capacity = 1024;
+    mm_trace_rec_t *recs;
+    int status;
+    mm_trace_reader_t *reader = mm_trace_open(path);
+    if (reader == NULL) {
+        return NULL;
+    }
+    recs = malloc(capacity * sizeof(*recs));
+    while (recs != NULL && (status = mm_trace_next(reader, &recs[used])) > 0) {
+        if (++used == capacity) {
+            mm_trace_rec_t *bigger;
+            capacity *= 2;
+            bigger = realloc(recs, capacity * sizeof(*recs));
+            if (bigger == NULL) {
+                free(recs);
+            }
+            recs = bigger;
+        }
+    }
+    mm_trace_close(reader);
+    if (recs == NULL || status < 0) {
+        free(recs);
+        return NULL;
+    }
+    qsort(recs, used, sizeof(*recs), compare_records);
+    *count = used;
+    return recs;
+}
+
+/*
+ * Open-addressing map from payload offset to driver block id, used while
+ * converting to text. Offsets are never 0 (0 means NULL), so 0 marks an
+ * empty slot; deleted slots keep a tombstone so probes can pass them.
+ */
+typedef struct id_map {
+    uint64_t *keys;
+    uint64_t *ids;
+    size_t capacity; // a power of two
+    size_t used;     // live keys plus tombstones
+} id_map_t;
+
+static const uint64_t tombstone = UINT64_MAX;
+
+static size_t id_map_slot(const id_map_t *map, uint64_t key) {
+    size_t mask = map->capacity - 1;
+    size_t slot = (size_t)((key * 0x9e3779b97f4a7c15u) >> 20) & mask;
+    while (map->keys[slot] != 0 && map->keys[slot] != key) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static bool id_map_put(id_map_t *map, uint64_t key, uint64_t id);
+
+static bool id_map_grow(id_map_t *map) {
+    id_map_t bigger;
+    size_t i;
+    bigger.capacity = map->capacity * 2;
+    bigger.used = 0;
+    bigger.keys = calloc(bigger.capacity, sizeof(uint64_t));
+    bigger.ids = calloc(bigger.capacity, sizeof(uint64_t));
+    if (bigger.keys == NULL || bigger.ids == NULL) {
+        free(bigger.keys);
+        free(bigger.ids);
+        return false;
+    }
+    for (i = 0; i < map->capacity; i++) {
+        if (map->keys[i] != 0 && map->keys[i] != tombstone) {
+            id_map_put(&bigger, map->keys[i], map->ids[i]);
+        }
+    }
+    free(map->keys);
+    free(map->ids);
+    *map = bigger;
+    return true;
+}
+
+static bool id_map_put(id_map_t *map, uint64_t key, uint64_t id) {
+    size_t slot;
+    if (2 * (map->used + 1) > map->capacity && !id_map_grow(map)) {
+        return false;
+    }
+    slot = id_map_slot(map, key);
+    if (map->keys[slot] == 0) {
+        map->used++;
+    }
+    map->keys[slot] = key;
+    map->ids[slot] = id;
+    return true;
+}
+
+/**
+ * look up and remove `key`; false if it is not mapped
+ */
+static bool id_map_take(id_map_t *map, uint64_t key, uint64_t *id) {
+    size_t slot = id_map_slot(map, key);
+    if (map->keys[slot] == 0) {
+        return false;
+    }
+    *id = map->ids[slot];
+    map->keys[slot] = tombstone;
+    return true;
+}
+
+/**
+ * convert a binary trace to driver operations, numbering blocks as they
+ * are allocated
+ */
+static mm_trace_op_t *ops_from_binary(const char *path, size_t *nops,
+                                      uint64_t *nids) {
+    size_t count = 0;
+    size_t used = 0;
+    size_t i;
+    uint64_t next_id = 0;
+    uint64_t id;
+    mm_trace_op_t *ops;
+    id_map_t map;
+    bool ok = true;
+    mm_trace_rec_t *recs = mm_trace_load(path, &count);
+    if (recs == NULL) {
+        return NULL;
+    }
+
+    map.capacity = 1024;
+    map.used = 0;
+    map.keys = calloc(map.capacity, sizeof(uint64_t));
+    map.ids = calloc(map.capacity, sizeof(uint64_t));
+    ops = malloc((count + 1) * sizeof(*ops));
+    if (map.keys == NULL || map.ids == NULL || ops == NULL) {
+        ok = false;
+    }
+
+    for (i = 0; ok && i < count; i++) {
+        mm_trace_rec_t *rec = &recs[i];
+        uint64_t size = rec->size;
+        if (rec->op == MM_OP_CALLOC) {
+            size *= rec->elements;
+        }
+        if (rec->op == MM_OP_FREE ||
+            (rec->op == MM_OP_REALLOC && rec->arg != 0 && size == 0)) {
+            if (rec->arg != 0 && id_map_take(&map, rec->arg, &id)) {
+                ops[used++] = (mm_trace_op_t){'f', id, 0};
+            }
+        } else if (rec->op == MM_OP_REALLOC && rec->arg != 0) {
+            if (rec->result != 0 && id_map_take(&map, rec->arg, &id)) {
+                ops[used++] = (mm_trace_op_t){'r', id, size};
+                ok = id_map_put(&map, rec->result, id);
+            }
+        } else if (rec->result != 0) { // malloc, calloc, realloc(NULL, n)
+            id = next_id++;
+            ops[used++] = (mm_trace_op_t){'a', id, size};
+            ok = id_map_put(&map, rec->result, id);
+        }
+    }
+
+    free(map.keys);
+    free(map.ids);
+    free(recs);
+    if (!ok) {
+        free(ops);
+        return NULL;
+    }
+    *nops = used;
+    *nids = next_id;
+    return ops;
+}
+
+/**
+ * parse a driver text trace, skipping its numeric header lines
+ */
+static mm_trace_op_t *ops_from_text(const char *path, size_t *nops,
+                                    uint64_t *nids) {
+    char line[256];
+    size_t used = 0;
+    size_t capacity = 1024;
+    uint64_t max_id = 0;
+    bool ok = true;
+    mm_trace_op_t *ops;
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+    ops = malloc(capacity * sizeof(*ops));
+    while (ops != NULL && ok && fgets(line, sizeof(line), file) != NULL) {
+        mm_trace_op_t op = {0, 0, 0};
+        char kind;
+        if (sscanf(line, " %c", &kind) != 1 || (kind >= '0' && kind <= '9')) {
+            continue; // blank or header line
+        }
+        op.kind = kind;
+        if (kind == 'f') {
+            ok = sscanf(line, " f %" SCNu64, &op.id) == 1;
+        } else if (kind == 'a' || kind == 'r' || kind == 'c') {
+            ok = sscanf(line + 1, " %" SCNu64 " %" SCNu64, &op.id,
+                        &op.size) == 2;
+        } else {
+            ok = false;
+        }
+        if (op.id + 1 > max_id) {
+            max_id = op.id + 1;
+        }
+        if (used == capacity) {
+            mm_trace_op_t *bigger;
+            capacity *= 2;
+            bigger = realloc(ops, capacity * sizeof(*ops));
+            if (bigger == NULL) {
+                free(ops);
+            }
+            ops = bigger;
+        }
+        if (ops != NULL) {
+            ops[used++] = op;
+        }
+    }
+    fclose(file);
+    if (ops == NULL || !ok) {
+        free(ops);
+        return NULL;
+    }
+    *nops = used;
+    *nids = max_id;
+    return ops;
+}
+
+mm_trace_op_t *mm_trace_load_ops(const char *path, size_t *nops,
+                                 uint64_t *nids) {
+    char magic[4] = {0};
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic)) {
+        magic[0] = 0;
+    }
+    fclose(file);
+    if (memcmp(magic, MM_TRACE_MAGIC, sizeof(magic)) == 0) {
+        return ops_from_binary(path, nops, nids);
+    }
+    return ops_from_text(path, nops, nids);
+}
+
+bool mm_trace_write_text(const char *in_path, FILE *out) {
+    size_t nops = 0;
+    size_t i;
+    uint64_t nids = 0;
+    uint64_t live = 0;
+    uint64_t peak = 0;
+    uint64_t *sizes; // live size of each id, for the heap size hint
+    mm_trace_op_t *ops = ops_from_binary(in_path, &nops, &nids);
+    if (ops == NULL) {
+        return false;
+    }
+    sizes = calloc(nids + 1, sizeof(*sizes));
+    if (sizes == NULL) {
+        free(ops);
+        return false;
+    }
+    for (i = 0; i < nops; i++) {
+        live -= sizes[ops[i].id];
+        sizes[ops[i].id] = ops[i].size;
+        live += ops[i].size;
+        if (live > peak) {
+            peak = live;
+        }
+    }
+
+    fprintf(out, "%" PRIu64 "\n%" PRIu64 "\n%zu\n1\n", peak, nids, nops);
+    for (i = 0; i < nops; i++) {
+        if (ops[i].kind == 'f') {
+            fprintf(out, "f %" PRIu64 "\n", ops[i].id);
+        } else {
+            fprintf(out, "%c %" PRIu64 " %" PRIu64 "\n", ops[i].kind,
+                    ops[i].id, ops[i].size);
+        }
+    }
+    free(sizes);
+    free(ops);
+    return !ferror(out);
+}
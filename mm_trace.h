@@ -0,0 +1,133 @@
+/**
+ * @file mm_trace.h
+ * @brief Binary allocation trace format, reader and text conversion
+ *
+ * mm.c built with -DMM_TRACE records every public call into per-thread
+ * ring buffers and streams them to a file in the format below (see
+ * mm_trace_start() in mm_ext.h). This header describes that format and
+ * declares the reader used by the conversion and replay tools.
+ *
+ * All integers after the magic are unsigned LEB128 varints.
+ *
+ *   file    := "MMTR" version:u8 chunk*
+ *   chunk   := 'C' thread first_seq base_time count record{count}
+ *            | 'K' ticks ns                  (clock calibration point)
+ *   record  := op:u8 fields time_delta
+ *   fields  := malloc:  size result
+ *              free:    arg
+ *              realloc: arg size result
+ *              calloc:  elements size result
+ *
+ * `arg` and `result` are payload offsets from the start of the heap plus
+ * one, with 0 standing for NULL. Times are ticks of mm_latency_now();
+ * each record stores the delta from the previous record of its chunk
+ * (the first from base_time). Sequence numbers are per thread and
+ * consecutive within a chunk. Two or more 'K' chunks let a reader turn
+ * ticks into nanoseconds.
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#ifndef MM_TRACE_H
+#define MM_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mm_ext.h"
+
+/** @brief File magic, followed by MM_TRACE_VERSION */
+#define MM_TRACE_MAGIC "MMTR"
+#define MM_TRACE_VERSION 1
+
+/** @brief Chunk tags */
+#define MM_TRACE_CHUNK_RECORDS 'C'
+#define MM_TRACE_CHUNK_CLOCK 'K'
+
+/** @brief One decoded call */
+typedef struct mm_trace_rec {
+    mm_op_t op;
+    uint32_t thread;   // small per-process thread number
+    uint64_t seq;      // per-thread call number
+    uint64_t size;     // requested bytes; element size for calloc
+    uint64_t elements; // calloc only
+    uint64_t arg;      // offset + 1 of the pointer passed in, 0 = NULL
+    uint64_t result;   // offset + 1 of the pointer returned, 0 = NULL
+    uint64_t time;     // ticks
+} mm_trace_rec_t;
+
+typedef struct mm_trace_reader mm_trace_reader_t;
+
+/**
+ * @brief Opens a binary trace for reading.
+ * @return The reader, or NULL if the file cannot be read or is not a trace
+ */
+mm_trace_reader_t *mm_trace_open(const char *path);
+
+/**
+ * @brief Decodes the next record, in file order (chunks of different
+ *        threads are not merged).
+ * @return 1 on success, 0 at end of file, -1 on a malformed file
+ */
+int mm_trace_next(mm_trace_reader_t *reader, mm_trace_rec_t *rec);
+
+/**
+ * @brief Ticks per nanosecond, from the clock chunks seen so far, or 0
+ *        if fewer than two have been read.
+ */
+double mm_trace_ticks_per_ns(const mm_trace_reader_t *reader);
+
+/**
+ * @brief Closes the reader.
+ */
+void mm_trace_close(mm_trace_reader_t *reader);
+
+/**
+ * @brief Reads all records of a trace and sorts them into time order.
+ * @param[in] path
+ * @param[out] count Number of records returned
+ * @return A malloc'ed array of records, or NULL on error
+ */
+mm_trace_rec_t *mm_trace_load(const char *path, size_t *count);
+
+/** @brief One operation of a driver trace */
+typedef struct mm_trace_op {
+    char kind;     // 'a', 'r', 'f', or 'c' for a zeroed 'a'
+    uint64_t id;   // block id
+    uint64_t size; // requested bytes ('a', 'r' and 'c')
+} mm_trace_op_t;
+
+/**
+ * @brief Loads a trace as driver operations.
+ *
+ * Binary traces are recognised by their magic and converted as described
+ * for mm_trace_write_text(); anything else is parsed as a driver text
+ * trace, whose numeric header lines are skipped. Besides the driver's
+ * `a`, `r` and `f` lines, text traces may contain `c id size`, a calloc
+ * of `size` bytes as written by mm_tracegen.
+ *
+ * @param[in] path
+ * @param[out] nops Number of operations returned
+ * @param[out] nids One more than the largest block id
+ * @return A malloc'ed array of operations, or NULL on error
+ */
+mm_trace_op_t *mm_trace_load_ops(const char *path, size_t *nops,
+                                 uint64_t *nids);
+
+/**
+ * @brief Converts a binary trace to the driver's text trace format.
+ *
+ * The output has the usual four header lines (suggested heap size, number
+ * of ids, number of ops, weight) followed by one `a id size`,
+ * `r id size` or `f id` line per call. Every allocation gets a fresh id;
+ * frees and reallocs find theirs by matching their offset against the
+ * live allocations. calloc becomes `a` of elements * size bytes.
+ * Calls on blocks allocated before recording started, and failed
+ * allocations, are dropped.
+ *
+ * @return true on success
+ */
+bool mm_trace_write_text(const char *in_path, FILE *out);
+
+#endif /* MM_TRACE_H */
@@ -0,0 +1,69 @@
+/**
+ * @file mm_tracecvt.c
+ * @brief Converts binary allocation traces to driver text traces
+ *
+ * Usage:
+ *   mm_tracecvt trace.mmtr [out.rep]   convert to the driver format
+ *   mm_tracecvt -d trace.mmtr          print every decoded record
+ *
+ * Build: cc -O2 -o mm_tracecvt mm_tracecvt.c mm_trace.c
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mm_trace.h"
+
+static const char *const op_names[MM_NUM_OPS] = {"malloc", "free", "realloc",
+                                                 "calloc", "extend_heap"};
+
+/**
+ * print the records in file order, one per line
+ */
+static int dump_records(const char *path) {
+    mm_trace_rec_t rec;
+    int status;
+    mm_trace_reader_t *reader = mm_trace_open(path);
+    if (reader == NULL) {
+        fprintf(stderr, "%s: not a readable trace\n", path);
+        return 1;
+    }
+    while ((status = mm_trace_next(reader, &rec)) > 0) {
+        printf("t%" PRIu32 " #%" PRIu64 " @%" PRIu64 " %s size=%" PRIu64
+               " elements=%" PRIu64 " arg=%" PRIu64 " result=%" PRIu64 "\n",
+               rec.thread, rec.seq, rec.time, op_names[rec.op], rec.size,
+               rec.elements, rec.arg, rec.result);
+    }
+    if (mm_trace_ticks_per_ns(reader) > 0) {
+        printf("ticks per ns: %.4f\n", mm_trace_ticks_per_ns(reader));
+    }
+    mm_trace_close(reader);
+    if (status < 0) {
+        fprintf(stderr, "%s: malformed trace\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    FILE *out = stdout;
+    if (argc == 3 && strcmp(argv[1], "-d") == 0) {
+        return dump_records(argv[2]);
+    }
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s [-d] trace.mmtr [out.rep]\n", argv[0]);
+        return 2;
+    }
+    if (argc == 3 && (out = fopen(argv[2], "w")) == NULL) {
+        perror(argv[2]);
+        return 1;
+    }
+    if (!mm_trace_write_text(argv[1], out)) {
+        fprintf(stderr, "%s: conversion failed\n", argv[1]);
+        return 1;
+    }
+    return (fclose(out) == 0) ? 0 : 1;
+}
@@ -0,0 +1,475 @@
+/**
+ * @file mm_tracegen.c
+ * @brief Generates synthetic allocation traces in the driver text format
+ *
+ * Usage:
+ *   mm_tracegen [-S seed] [-n allocations] [-s sizes] [-l lifetimes]
+ *               [-r prob,steps,factor] [-c ratio] [-H trace] [out.rep]
+ *
+ * Time is counted in allocations: every step allocates one block, after
+ * first freeing the blocks whose lifetime has run out. Blocks still live
+ * after the last step are freed in the order they would have died, so a
+ * generated trace always ends with an empty heap.
+ *
+ *   -s pow,MIN,MAX,ALPHA    sizes from a power law (Pareto with exponent
+ *                           ALPHA) truncated to [MIN, MAX]; the default
+ *                           is pow,16,65536,1.2
+ *   -s bimodal,S1,S2,P      a fraction P of the sizes near S1, the rest
+ *                           near S2 (uniform over half to one and a half
+ *                           times the mode, and at least 1)
+ *   -l exp,MEAN             exponential lifetimes, MEAN allocations on
+ *                           average (the default is exp,10000); about MEAN
+ *                           blocks are live in the steady state
+ *   -l phase,LEN,KEEP       blocks die together at the end of their phase
+ *                           of LEN allocations, except a fraction KEEP that
+ *                           lives until the end of the trace
+ *   -r prob,steps,factor    a fraction `prob` of the blocks are grown by
+ *                           realloc `steps` times, by `factor` each time,
+ *                           at even intervals over their lifetime
+ *   -c ratio                a fraction of the allocations are callocs;
+ *                           these are written as `c id size` lines, which
+ *                           mm_replay understands but the class driver
+ *                           does not
+ *   -H trace                draw (size, lifetime) pairs from a recorded
+ *                           binary or text trace instead of -s and -l;
+ *                           blocks that were never freed there live until
+ *                           the end
+ *
+ * The same seed and options always give the same trace. The trace is
+ * generated twice, once to count the operations and the peak live bytes
+ * for the header and once to write it, so millions of live blocks take
+ * only the memory of the pending events.
+ *
+ * Build: cc -O2 -o mm_tracegen mm_tracegen.c mm_trace.c -lm
+ *
+ * @author Erica Wang <xinyiwan@andrew.cmu.edu>
+ */
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_trace.h"
+
+/** @brief Largest size a realloc chain grows a block to */
+#define MAX_GROWN_SIZE ((uint64_t)1 << 30)
+
+/** @brief Lifetime of blocks that live until the end of the trace */
+#define FOREVER UINT64_MAX
+
+typedef enum { SIZE_POW, SIZE_BIMODAL, SIZE_RECORDED } size_dist_t;
+typedef enum { LIFE_EXP, LIFE_PHASE, LIFE_RECORDED } life_dist_t;
+
+/** @brief Everything the command line sets */
+typedef struct config {
+    uint64_t seed;
+    uint64_t allocations;
+    size_dist_t size_dist;
+    double size_arg[3];
+    life_dist_t life_dist;
+    double life_arg[2];
+    double realloc_prob;
+    int realloc_steps;
+    double realloc_factor;
+    double calloc_ratio;
+    // -H: (size, lifetime) pairs of the recorded trace
+    uint64_t *rec_sizes;
+    uint64_t *rec_lives;
+    size_t nrecorded;
+} config_t;
+
+/** @brief A pending realloc or free */
+typedef struct event {
+    uint64_t time;
+    uint64_t order; // insertion number, to break ties deterministically
+    uint64_t id;
+    uint64_t size;  // new size for a realloc, 0 for a free
+} event_t;
+
+/** @brief Binary min-heap of events by (time, order) */
+typedef struct queue {
+    event_t *events;
+    size_t count;
+    size_t capacity;
+    uint64_t next_order;
+} queue_t;
+
+/** @brief Where one pass of the generator sends its operations */
+typedef struct output {
+    FILE *out;         // NULL on the counting pass
+    uint64_t ops;
+    uint64_t live;     // live requested bytes
+    uint64_t peak;
+    uint64_t *sizes;   // current size of each id
+} output_t;
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Random numbers
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * splitmix64: the trace must only depend on the seed, not on the libc
+ */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return z ^ (z >> 31);
+}
+
+/**
+ * uniform in [0, 1)
+ */
+static double uniform(uint64_t *state) {
+    return (double)(next_random(state) >> 11) * 0x1.0p-53;
+}
+
+static uint64_t draw_size(const config_t *cfg, uint64_t *state) {
+    double u = uniform(state);
+    if (cfg->size_dist == SIZE_POW) {
+        double lo = cfg->size_arg[0];
+        double hi = cfg->size_arg[1];
+        double alpha = cfg->size_arg[2];
+        // inverse CDF of the Pareto distribution truncated to [lo, hi]
+        double tail = 1 - pow(lo / hi, alpha);
+        return (uint64_t)(lo / pow(1 - u * tail, 1 / alpha));
+    } else {
+        double mode = (u < cfg->size_arg[2]) ? cfg->size_arg[0]
+                                             : cfg->size_arg[1];
+        uint64_t size = (uint64_t)(mode * (0.5 + uniform(state)));
+        return (size < 1) ? 1 : size;
+    }
+}
+
+static uint64_t draw_lifetime(const config_t *cfg, uint64_t *state,
+                              uint64_t now) {
+    if (cfg->life_dist == LIFE_EXP) {
+        double life = -cfg->life_arg[0] * log(1 - uniform(state));
+        return (life < 1) ? 1 : (uint64_t)life;
+    } else {
+        uint64_t length = (uint64_t)cfg->life_arg[0];
+        if (uniform(state) < cfg->life_arg[1]) {
+            return FOREVER;
+        }
+        return length - now % length; // until the end of this phase
+    }
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Event queue
+ * ---------------------------------------------------------------------------
+ */
+
+static bool event_before(const event_t *a, const event_t *b) {
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+static void queue_push(queue_t *q, uint64_t time, uint64_t id,
+                       uint64_t size) {
+    event_t ev = {time, q->next_order++, id, size};
+    size_t i;
+    if (q->count == q->capacity) {
+        q->capacity = (q->capacity == 0) ? 1024 : 2 * q->capacity;
+        q->events = realloc(q->events, q->capacity * sizeof(event_t));
+        if (q->events == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    for (i = q->count++; i > 0; i = (i - 1) / 2) {
+        event_t *parent = &q->events[(i - 1) / 2];
+        if (!event_before(&ev, parent)) {
+            break;
+        }
+        q->events[i] = *parent;
+    }
+    q->events[i] = ev;
+}
+
+static event_t queue_pop(queue_t *q) {
+    event_t top = q->events[0];
+    event_t last = q->events[--q->count];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= q->count) {
+            break;
+        }
+        if (child + 1 < q->count &&
+            event_before(&q->events[child + 1], &q->events[child])) {
+            child++;
+        }
+        if (!event_before(&q->events[child], &last)) {
+            break;
+        }
+        q->events[i] = q->events[child];
+        i = child;
+    }
+    if (q->count > 0) {
+        q->events[i] = last;
+    }
+    return top;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Generator
+ * ---------------------------------------------------------------------------
+ */
+
+static void emit(output_t *out, char kind, uint64_t id, uint64_t size) {
+    out->ops++;
+    out->live -= out->sizes[id];
+    out->sizes[id] = (kind == 'f') ? 0 : size;
+    out->live += out->sizes[id];
+    if (out->live > out->peak) {
+        out->peak = out->live;
+    }
+    if (out->out == NULL) {
+        return;
+    }
+    if (kind == 'f') {
+        fprintf(out->out, "f %" PRIu64 "\n", id);
+    } else {
+        fprintf(out->out, "%c %" PRIu64 " %" PRIu64 "\n", kind, id, size);
+    }
+}
+
+static void run_event(output_t *out, const event_t *ev) {
+    emit(out, ev->size == 0 ? 'f' : 'r', ev->id, ev->size);
+}
+
+/**
+ * schedule the reallocs of a growth chain and the free of block `id`
+ */
+static void schedule(const config_t *cfg, queue_t *q, uint64_t *state,
+                     uint64_t id, uint64_t size, uint64_t now,
+                     uint64_t lifetime) {
+    uint64_t death = (lifetime == FOREVER) ? FOREVER : now + lifetime;
+    if (cfg->realloc_steps > 0 && uniform(state) < cfg->realloc_prob) {
+        // spread the chain over the lifetime, or over the rest of the
+        // trace for blocks that never die
+        uint64_t span = (lifetime == FOREVER || now + lifetime >
+                                                    cfg->allocations)
+                            ? cfg->allocations - now
+                            : lifetime;
+        uint64_t gap = span / (uint64_t)(cfg->realloc_steps + 1);
+        int step;
+        for (step = 1; step <= cfg->realloc_steps; step++) {
+            size = (uint64_t)((double)size * cfg->realloc_factor);
+            if (size > MAX_GROWN_SIZE) {
+                size = MAX_GROWN_SIZE;
+            }
+            queue_push(q, now + gap * (uint64_t)step, id,
+                       (size == 0) ? 1 : size);
+        }
+    }
+    queue_push(q, death, id, 0);
+}
+
+/**
+ * one full pass over the trace; every pass with the same configuration
+ * emits the same operations
+ */
+static void generate(const config_t *cfg, output_t *out) {
+    queue_t q = {NULL, 0, 0, 0};
+    uint64_t state = cfg->seed;
+    uint64_t now;
+    for (now = 0; now < cfg->allocations; now++) {
+        uint64_t size, lifetime;
+        while (q.count > 0 && q.events[0].time <= now) {
+            event_t ev = queue_pop(&q);
+            run_event(out, &ev);
+        }
+        if (cfg->nrecorded > 0) {
+            size_t pick = (size_t)(next_random(&state) % cfg->nrecorded);
+            size = cfg->rec_sizes[pick];
+            lifetime = cfg->rec_lives[pick];
+        } else {
+            size = draw_size(cfg, &state);
+            lifetime = draw_lifetime(cfg, &state, now);
+        }
+        if (cfg->calloc_ratio > 0 && uniform(&state) < cfg->calloc_ratio) {
+            emit(out, 'c', now, size);
+        } else {
+            emit(out, 'a', now, size);
+        }
+        schedule(cfg, &q, &state, now, size, now, lifetime);
+    }
+    while (q.count > 0) {
+        event_t ev = queue_pop(&q);
+        run_event(out, &ev);
+    }
+    free(q.events);
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Recorded distributions
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * collect the (first size, lifetime in allocations) pair of every block
+ * of a recorded trace
+ */
+static bool load_recorded(config_t *cfg, const char *path) {
+    size_t nops = 0;
+    uint64_t nids = 0;
+    uint64_t allocs = 0;
+    uint64_t *born;
+    size_t i;
+    mm_trace_op_t *ops = mm_trace_load_ops(path, &nops, &nids);
+    if (ops == NULL || nids == 0) {
+        free(ops);
+        return false;
+    }
+    born = calloc(nids, sizeof(uint64_t));
+    cfg->rec_sizes = calloc(nids, sizeof(uint64_t));
+    cfg->rec_lives = calloc(nids, sizeof(uint64_t));
+    if (born == NULL || cfg->rec_sizes == NULL || cfg->rec_lives == NULL) {
+        free(ops);
+        free(born);
+        return false;
+    }
+    for (i = 0; i < nids; i++) {
+        cfg->rec_lives[i] = FOREVER;
+    }
+    for (i = 0; i < nops; i++) {
+        uint64_t id = ops[i].id;
+        if (ops[i].kind == 'a' || ops[i].kind == 'c') {
+            born[id] = allocs++;
+            cfg->rec_sizes[id] = ops[i].size;
+        } else if (ops[i].kind == 'f') {
+            uint64_t life = allocs - born[id];
+            cfg->rec_lives[id] = (life == 0) ? 1 : life;
+        }
+    }
+    cfg->nrecorded = (size_t)nids;
+    cfg->size_dist = SIZE_RECORDED;
+    cfg->life_dist = LIFE_RECORDED;
+    free(born);
+    free(ops);
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        Driver
+ * ---------------------------------------------------------------------------
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-S seed] [-n allocations] [-s sizes] "
+            "[-l lifetimes]\n"
+            "       [-r prob,steps,factor] [-c ratio] [-H trace] "
+            "[out.rep]\n"
+            "sizes:     pow,MIN,MAX,ALPHA | bimodal,S1,S2,P\n"
+            "lifetimes: exp,MEAN | phase,LEN,KEEP\n",
+            prog);
+    exit(2);
+}
+
+static bool parse_sizes(config_t *cfg, const char *spec) {
+    double *a = cfg->size_arg;
+    if (sscanf(spec, "pow,%lf,%lf,%lf", &a[0], &a[1], &a[2]) == 3) {
+        cfg->size_dist = SIZE_POW;
+        return a[0] >= 1 && a[1] >= a[0] && a[2] > 0;
+    }
+    if (sscanf(spec, "bimodal,%lf,%lf,%lf", &a[0], &a[1], &a[2]) == 3) {
+        cfg->size_dist = SIZE_BIMODAL;
+        return a[0] >= 1 && a[1] >= 1 && a[2] >= 0 && a[2] <= 1;
+    }
+    return false;
+}
+
+static bool parse_lifetimes(config_t *cfg, const char *spec) {
+    double *a = cfg->life_arg;
+    if (sscanf(spec, "exp,%lf", &a[0]) == 1) {
+        cfg->life_dist = LIFE_EXP;
+        return a[0] > 0;
+    }
+    if (sscanf(spec, "phase,%lf,%lf", &a[0], &a[1]) == 2) {
+        cfg->life_dist = LIFE_PHASE;
+        return a[0] >= 1 && a[1] >= 0 && a[1] <= 1;
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    config_t cfg = {42, 1000000, SIZE_POW, {16, 65536, 1.2}, LIFE_EXP,
+                    {10000, 0}, 0, 0, 1, 0, NULL, NULL, 0};
+    const char *recorded = NULL;
+    output_t out;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "S:n:s:l:r:c:H:")) != -1) {
+        if (opt == 'S') {
+            cfg.seed = strtoull(optarg, NULL, 0);
+        } else if (opt == 'n') {
+            cfg.allocations = strtoull(optarg, NULL, 0);
+        } else if (opt == 's') {
+            if (!parse_sizes(&cfg, optarg)) {
+                usage(argv[0]);
+            }
+        } else if (opt == 'l') {
+            if (!parse_lifetimes(&cfg, optarg)) {
+                usage(argv[0]);
+            }
+        } else if (opt == 'r') {
+            if (sscanf(optarg, "%lf,%d,%lf", &cfg.realloc_prob,
+                       &cfg.realloc_steps, &cfg.realloc_factor) != 3 ||
+                cfg.realloc_steps < 0 || cfg.realloc_factor <= 0) {
+                usage(argv[0]);
+            }
+        } else if (opt == 'c') {
+            if (sscanf(optarg, "%lf", &cfg.calloc_ratio) != 1 ||
+                !(cfg.calloc_ratio >= 0 && cfg.calloc_ratio <= 1)) {
+                usage(argv[0]);
+            }
+        } else if (opt == 'H') {
+            recorded = optarg;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (optind + 1 < argc || cfg.allocations == 0) {
+        usage(argv[0]);
+    }
+    if (recorded != NULL && !load_recorded(&cfg, recorded)) {
+        fprintf(stderr, "%s: cannot load trace\n", recorded);
+        return 1;
+    }
+
+    memset(&out, 0, sizeof(out));
+    out.sizes = calloc(cfg.allocations, sizeof(uint64_t));
+    if (out.sizes == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    generate(&cfg, &out); // count only
+
+    out.out = stdout;
+    if (optind < argc && (out.out = fopen(argv[optind], "w")) == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    fprintf(out.out, "%" PRIu64 "\n%" PRIu64 "\n%" PRIu64 "\n1\n", out.peak,
+            cfg.allocations, out.ops);
+    out.ops = out.live = out.peak = 0;
+    generate(&cfg, &out);
+
+    free(out.sizes);
+    free(cfg.rec_sizes);
+    free(cfg.rec_lives);
+    return (fclose(out.out) == 0) ? 0 : 1;
+}
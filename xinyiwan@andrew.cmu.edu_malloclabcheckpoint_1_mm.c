@@ -27,8 +27,40 @@
 #include <string.h>
 #include <unistd.h>
 
+/* The preload library is always thread-safe */
+#if defined(MM_PRELOAD) && !defined(MM_THREADSAFE)
+#define MM_THREADSAFE
+#endif
+
+#if defined(MM_LATENCY) || defined(MM_TRACE) || defined(MM_THREADSAFE)
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(MM_TRACE) || defined(MM_PARALLEL_CHECK) || defined(MM_THREADSAFE)
+#include <stdatomic.h>
+#endif
+
+#ifdef MM_THREADSAFE
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
 #include "memlib.h"
 #include "mm.h"
+#include "mm_checkpoint.h"
+#include "mm_ext.h"
+#include "mm_snapshot.h"
+#include "mm_trace.h"
 
 /* Do not change the following! */
 
@@ -69,6 +101,31 @@
 #define dbg_printheap(...) ((void)sizeof(__VA_ARGS__))
 #endif
 
+/*
+ * Heap checking after each operation. Operations note the blocks they
+ * leave behind with dbg_touch and end with dbg_checkheap, which checks as
+ * much as the runtime level asks for (see mm_check_set_level). DEBUG
+ * builds assert on failure; -DMM_RUNTIME_CHECK enables the same checks in
+ * a release build, which aborts on failure. Other builds drop both.
+ *
+ * At the local level every MM_CHECK_INTERVAL-th check is a full
+ * mm_checkheap; -DMM_CHECK_INTERVAL=1 makes every check full.
+ */
+#if defined(DEBUG)
+#define dbg_touch(block) note_touched(block)
+#define dbg_checkheap(line) assert(check_point(line))
+#elif defined(MM_RUNTIME_CHECK)
+#define dbg_touch(block) note_touched(block)
+#define dbg_checkheap(line) ((void)(check_point(line) || check_failed(line)))
+#else
+#define dbg_touch(block) ((void)sizeof(block))
+#define dbg_checkheap(line) ((void)sizeof(line))
+#endif
+
+#ifndef MM_CHECK_INTERVAL
+#define MM_CHECK_INTERVAL 1024
+#endif
+
 /* Basic constants */
 
 typedef uint64_t word_t;
@@ -110,8 +167,8 @@ typedef struct block {
     word_t header;
     union {
         struct {
-            struct block *next;
-            struct block *prev;
+            word_t next; // offsets from heap_base, 0 for none, so that
+            word_t prev; // the heap image does not depend on its address
         }; // doubly linked list
         char payload[0];
     };
@@ -119,8 +176,42 @@ typedef struct block {
 
 /* Global variables */
 
-/** @brief Pointer to first block in the heap */
-static block_t *heap_start = NULL;
+/**
+ * @brief One heap: the allocator state, and the memory it grows into.
+ *
+ * The default heap gets its memory from memlib. A heap made by
+ * mm_heap_create, or a shared heap while a call runs on it, grows into
+ * the `capacity` bytes at `lo` instead. The allocator reaches the memory
+ * through heap_sbrk, heap_lo and heap_hi.
+ */
+struct mm_heap {
+    block_t *heap_start;   // first block in the heap, NULL before mm_init
+    char *heap_base;       // heap_lo(), which free list links are offsets
+    block_t *seg_list[15]; // segregated free lists
+    char *lo;              // the heap's memory, NULL for memlib
+    uint64_t capacity;     // bytes at lo
+    uint64_t brk;          // bytes of them in use
+};
+typedef struct mm_heap heap_t;
+
+/** @brief The heap of malloc, free, realloc and calloc */
+static heap_t default_heap;
+
+/**
+ * @brief Storage class of state that belongs to the operation in progress,
+ *        which with threads means one copy per thread.
+ */
+#ifdef MM_THREADSAFE
+#define PER_THREAD __thread __attribute__((tls_model("initial-exec")))
+#else
+#define PER_THREAD
+#endif
+
+/**
+ * @brief The heap the allocator is working on. Calls on other heaps make
+ *        them current for their duration.
+ */
+static PER_THREAD heap_t *cur_heap = &default_heap;
 
 /*
  *****************************************************************************
@@ -142,6 +233,45 @@ static block_t *heap_start = NULL;
  * ---------------------------------------------------------------------------
  */
 
+/**
+ * @brief Extends the current heap by `incr` bytes, like mem_sbrk.
+ * @param[in] incr
+ * @return The old end of the heap, or (void *)-1 if it cannot grow
+ */
+static void *heap_sbrk(intptr_t incr) {
+    heap_t *heap = cur_heap;
+    char *old;
+    if (heap->lo == NULL) {
+        return mem_sbrk(incr);
+    }
+    if (incr < 0 || (uint64_t)incr > heap->capacity - heap->brk) {
+        return (void *)-1;
+    }
+    old = heap->lo + heap->brk;
+    heap->brk += (uint64_t)incr;
+    return old;
+}
+
+/**
+ * @brief Returns the first byte of the current heap, like mem_heap_lo.
+ */
+static char *heap_lo(void) {
+    if (cur_heap->lo == NULL) {
+        return mem_heap_lo();
+    }
+    return cur_heap->lo;
+}
+
+/**
+ * @brief Returns the last byte of the current heap, like mem_heap_hi.
+ */
+static char *heap_hi(void) {
+    if (cur_heap->lo == NULL) {
+        return mem_heap_hi();
+    }
+    return cur_heap->lo + cur_heap->brk - 1;
+}
+
 /**
  * @brief Returns the maximum of two integers.
  * @param[in] x
@@ -167,6 +297,14 @@ static size_t round_up(size_t size, size_t n) {
     }
 }
 
+/**
+ * @brief Rounds `size` up to a multiple of `n`, a power of two, without
+ *        round_up's minimum of min_block_size.
+ */
+static size_t align_up(size_t size, size_t n) {
+    return (size + n - 1) & ~(n - 1);
+}
+
 /**
  * @brief Packs the `size` and `alloc` of a block into a word suitable for
  *        use as a packed value.
@@ -326,7 +464,7 @@ static bool get_prev_alloc(block_t *block) {
  */
 static void write_epilogue(block_t *block) {
     dbg_requires(block != NULL);
-    dbg_requires((char *)block == (char *)mem_heap_hi() - 7);
+    dbg_requires((char *)block == heap_hi() - 7);
     block->header = pack(0, true, false);
 }
 
@@ -420,6 +558,47 @@ static block_t *find_prev(block_t *block) {
     return footer_to_header(footerp);
 }
 
+/**
+ * @brief Turns a free list link back into a block.
+ * @param[in] offset An offset from heap_base, or 0
+ * @return The block at `offset`, or NULL for 0
+ */
+static block_t *link_to_block(word_t offset) {
+    return (offset == 0) ? NULL : (block_t *)(cur_heap->heap_base + offset);
+}
+
+/**
+ * @brief Turns a block into a free list link; no block starts at offset 0,
+ *        which holds the prologue.
+ * @param[in] block A block, or NULL
+ * @return The offset of `block` from heap_base, or 0 for NULL
+ */
+static word_t block_to_link(block_t *block) {
+    return (block == NULL) ? 0 : (word_t)((char *)block - cur_heap->heap_base);
+}
+
+/**
+ * @brief Returns the block after `block` in its free list, or NULL.
+ */
+static block_t *list_next(block_t *block) {
+    return link_to_block(block->next);
+}
+
+/**
+ * @brief Returns the block before `block` in its free list, or NULL.
+ */
+static block_t *list_prev(block_t *block) {
+    return link_to_block(block->prev);
+}
+
+static void set_list_next(block_t *block, block_t *next) {
+    block->next = block_to_link(next);
+}
+
+static void set_list_prev(block_t *block, block_t *prev) {
+    block->prev = block_to_link(prev);
+}
+
 /*
  * ---------------------------------------------------------------------------
  *                        END SHORT HELPER FUNCTIONS
@@ -428,8 +607,7 @@ static block_t *find_prev(block_t *block) {
 
 /******** The remaining content below are helper and debug routines ********/
 static const int list_length =
-    15;                       // There are 15 block lists in my segregated list
-static block_t *seg_list[15]; // doubly linked list implementation
+    15; // There are 15 block lists in my segregated list
 
 static const word_t list0 = 32;     //[32,64)
 static const word_t list1 = 64;     //[64,96)
@@ -450,6 +628,13 @@ static const word_t list14 = 65536; //[65536,inf)
 // declare ahead to be called
 static void print_linkedList(void);
 static block_t *coalesce_block(block_t *block);
+#if defined(DEBUG) || defined(MM_RUNTIME_CHECK)
+static void note_touched(block_t *block);
+static bool check_point(int line);
+#endif
+#if !defined(DEBUG) && defined(MM_RUNTIME_CHECK)
+static bool check_failed(int line);
+#endif
 
 /**
  * find the index of the block in seg_list
@@ -490,26 +675,78 @@ static int find_index(size_t size) {
     return list_index;
 }
 
+/**
+ * get the size range [lo, hi) of the blocks kept in seg_list[index]
+ */
+static void list_bounds(int index, size_t *lo, size_t *hi) {
+    if (index == 0) {
+        *lo = list0;
+        *hi = list1;
+    } else if (index == 1) {
+        *lo = list1;
+        *hi = list2;
+    } else if (index == 2) {
+        *lo = list2;
+        *hi = list3;
+    } else if (index == 3) {
+        *lo = list3;
+        *hi = list4;
+    } else if (index == 4) {
+        *lo = list4;
+        *hi = list5;
+    } else if (index == 5) {
+        *lo = list5;
+        *hi = list6;
+    } else if (index == 6) {
+        *lo = list6;
+        *hi = list7;
+    } else if (index == 7) {
+        *lo = list7;
+        *hi = list8;
+    } else if (index == 8) {
+        *lo = list8;
+        *hi = list9;
+    } else if (index == 9) {
+        *lo = list9;
+        *hi = list10;
+    } else if (index == 10) {
+        *lo = list10;
+        *hi = list11;
+    } else if (index == 11) {
+        *lo = list11;
+        *hi = list12;
+    } else if (index == 12) {
+        *lo = list12;
+        *hi = list13;
+    } else if (index == 13) {
+        *lo = list13;
+        *hi = list14;
+    } else {
+        *lo = list14;
+        *hi = 0xffffffffffffffff;
+    }
+}
+
 /**
  * remove the block (should be free) from seg_list
  */
 static void remove_from_list(block_t *block) {
     size_t size = get_size(block);
     int index = find_index(size);
-    block_t *block_prev = block->prev;
-    block_t *block_next = block->next;
+    block_t *block_prev = list_prev(block);
+    block_t *block_next = list_next(block);
     if (block_prev == NULL && block_next == NULL) {
-        seg_list[index] = NULL;
+        cur_heap->seg_list[index] = NULL;
     } else if (block_prev != NULL &&
                block_next == NULL) { /* currently at the last free block*/
-        block_prev->next = NULL;
+        set_list_next(block_prev, NULL);
     } else if (block_prev == NULL &&
                block_next != NULL) { /* currently at the first free block*/
-        seg_list[index] = block_next;
-        block_next->prev = NULL;
+        cur_heap->seg_list[index] = block_next;
+        set_list_prev(block_next, NULL);
     } else { /* neither block_prev nor block_next is NULL */
-        block_prev->next = block_next;
-        block_next->prev = block_prev;
+        set_list_next(block_prev, block_next);
+        set_list_prev(block_next, block_prev);
     }
 }
 
@@ -519,447 +756,888 @@ static void remove_from_list(block_t *block) {
 static void add_to_list(block_t *block) { /* FIFO insertion */
     size_t size = get_size(block);
     int index = find_index(size);
-    if (seg_list[index] ==
+    if (cur_heap->seg_list[index] ==
         NULL) { /* block is the only elem in seg_list[index] */
-        block->next = NULL;
-        block->prev = NULL;
-        seg_list[index] = block;
+        set_list_next(block, NULL);
+        set_list_prev(block, NULL);
+        cur_heap->seg_list[index] = block;
     } else {
-        block->prev = NULL;
-        block->next = seg_list[index];
-        seg_list[index]->prev = block;
-        seg_list[index] = block;
+        set_list_prev(block, NULL);
+        set_list_next(block, cur_heap->seg_list[index]);
+        set_list_prev(cur_heap->seg_list[index], block);
+        cur_heap->seg_list[index] = block;
     }
+    dbg_touch(block);
 }
 
-/**
- * @brief
- *
- * <What does this function do?>
- * <What are the function's arguments?>
- * <What is the function's return value?>
- * <Are there any preconditions or postconditions?>
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN FIND_FIT STATISTICS
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * When MM_FIT_STATS is defined, find_fit reports every search here. The
+ * histograms are indexed by the requested size class, which is the seg_list
+ * bin of the adjusted size. Without MM_FIT_STATS the recording functions
+ * are empty and the compiler drops the calls and the counting in find_fit.
  *
- * @param[in] size
- * @return
+ * Only searches of the default heap are recorded. Under MM_THREADSAFE they
+ * run under heap_lock, while calls on private heaps may run in several
+ * threads at once.
  */
-static block_t *extend_heap(size_t size) {
-    void *bp;
+#ifdef MM_FIT_STATS
+/** @brief Number of log2 buckets for nodes visited: 0, 1, 2-3, 4-7, ... */
+#define FIT_NODE_BUCKETS 20
+
+static struct {
+    uint64_t calls[15];
+    uint64_t misses[15];
+    uint64_t nodes[15];                    // total nodes visited
+    uint64_t max_nodes[15];                // longest single search
+    uint64_t node_hist[15][FIT_NODE_BUCKETS];
+    uint64_t probe_hist[15][15];           // bins probed - 1
+    uint64_t found_in[15][16];             // bin of the fit, 15 = miss
+    uint64_t bin_nodes[15];                // nodes walked inside each bin
+} fit_stats;
 
-    // Allocate an even number of words to maintain alignment
-    size = round_up(size, dsize);
-    if ((bp = mem_sbrk((intptr_t)size)) == (void *)-1) {
-        return NULL;
+/**
+ * map a node count to its log2 histogram bucket
+ */
+static int fit_node_bucket(size_t nodes) {
+    int bucket = 0;
+    while (nodes != 0 && bucket < FIT_NODE_BUCKETS - 1) {
+        nodes >>= 1;
+        bucket++;
     }
-
-    // Initialize free block header/footer
-    block_t *block = payload_to_header(bp);
-    write_block(block, size, false, get_prev_alloc(block));
-
-    // Create new epilogue header
-    block_t *block_next = find_next(block);
-    write_epilogue(block_next);
-
-    // Coalesce in case the previous block was free
-    block = coalesce_block(block);
-    add_to_list(block);
-
-    // printf("printing linkedList in extend heap\n...");
-    // print_linkedList();
-
-    dbg_requires(mm_checkheap(__LINE__));
-    return block;
+    return bucket;
 }
+#endif /* MM_FIT_STATS */
 
 /**
- * @brief
- *
- * <What does this function do?>
- * <What are the function's arguments?>
- * <What is the function's return value?>
- * <Are there any preconditions or postconditions?>
- *
- * @param[in] block
- * @param[in] asize
+ * account for `nodes` list nodes walked inside seg_list[index]
  */
-static void split_block(block_t *block, size_t asize) {
-    dbg_requires(asize % dsize == 0);
-    /* TODO: Can you write a precondition about the value of asize? */
-    remove_from_list(block);
-    size_t block_size = get_size(block);
-
-    if ((block_size - asize) >= min_block_size) {
-        block_t *block_next;
-        write_block(block, asize, true, get_prev_alloc(block));
+static void fit_stats_walked(int index, size_t nodes) {
+#ifdef MM_FIT_STATS
+    if (cur_heap != &default_heap) {
+        return;
+    }
+    fit_stats.bin_nodes[index] += nodes;
+#else
+    (void)index;
+    (void)nodes;
+#endif
+}
 
-        block_next = find_next(block);
-        write_block(block_next, block_size - asize, false, true);
-        add_to_list(block_next);
-    } else {
-        write_block(block, block_size, true, get_prev_alloc(block));
-        update_next_prev_alloc(block, true);
+/**
+ * record one find_fit call for size class `first_index` that visited
+ * `nodes` nodes and stopped in bin `last_index` (list_length on a miss)
+ */
+static void fit_stats_record(int first_index, int last_index, size_t nodes) {
+#ifdef MM_FIT_STATS
+    int probes = (last_index < list_length ? last_index : list_length - 1) -
+                 first_index + 1;
+    if (cur_heap != &default_heap) {
+        return;
     }
+    fit_stats.calls[first_index]++;
+    if (last_index == list_length) {
+        fit_stats.misses[first_index]++;
+    }
+    fit_stats.nodes[first_index] += nodes;
+    if (nodes > fit_stats.max_nodes[first_index]) {
+        fit_stats.max_nodes[first_index] = nodes;
+    }
+    fit_stats.node_hist[first_index][fit_node_bucket(nodes)]++;
+    fit_stats.probe_hist[first_index][probes - 1]++;
+    fit_stats.found_in[first_index][last_index]++;
+#else
+    (void)first_index;
+    (void)last_index;
+    (void)nodes;
+#endif
+}
 
-    dbg_ensures(get_alloc(block));
+/**
+ * clear the find_fit histograms
+ */
+void mm_fit_stats_reset(void) {
+#ifdef MM_FIT_STATS
+    memset(&fit_stats, 0, sizeof(fit_stats));
+#endif
 }
 
 /**
- * @brief
- *
- * <What does this function do?>
- * <What are the function's arguments?>
- * <What is the function's return value?>
- * <Are there any preconditions or postconditions?>
- *
- * @param[in] asize
- * @return
+ * print the find_fit histograms, one block of lines per size class that
+ * has seen at least one call
  */
-static block_t *find_fit(size_t asize) {
-    block_t *block;
+void mm_fit_stats_dump(FILE *out) {
+#ifdef MM_FIT_STATS
     int index;
-    for (index = find_index(asize); index < list_length; index++) {
-        block = seg_list[index];
-        while (block != NULL) {
-            if (!(get_alloc(block)) && (asize <= get_size(block))) {
-                return block;
-            }
-            block = block->next;
+    int i;
+    size_t lo;
+    size_t hi;
+    fprintf(out, "find_fit statistics\n");
+    for (index = 0; index < list_length; index++) {
+        uint64_t calls = fit_stats.calls[index];
+        if (calls == 0) {
+            continue;
+        }
+        list_bounds(index, &lo, &hi);
+        fprintf(out,
+                "class %2d [%zu,%zu): calls %" PRIu64 " misses %" PRIu64
+                " avg nodes %.2f max nodes %" PRIu64 "\n",
+                index, lo, hi, calls, fit_stats.misses[index],
+                (double)fit_stats.nodes[index] / (double)calls,
+                fit_stats.max_nodes[index]);
+        fprintf(out, "  nodes visited (0, 1, 2-3, 4-7, ...):");
+        for (i = 0; i < FIT_NODE_BUCKETS; i++) {
+            fprintf(out, " %" PRIu64, fit_stats.node_hist[index][i]);
+        }
+        fprintf(out, "\n  bins probed (1, 2, ...):");
+        for (i = 0; i < list_length - index; i++) {
+            fprintf(out, " %" PRIu64, fit_stats.probe_hist[index][i]);
         }
+        fprintf(out, "\n  found in bin (%d, ..., 14, miss):", index);
+        for (i = index; i <= list_length; i++) {
+            fprintf(out, " %" PRIu64, fit_stats.found_in[index][i]);
+        }
+        fprintf(out, "\n");
     }
-    return NULL;
+    fprintf(out, "nodes walked per bin:");
+    for (index = 0; index < list_length; index++) {
+        fprintf(out, " %" PRIu64, fit_stats.bin_nodes[index]);
+    }
+    fprintf(out, "\n");
+#else
+    fprintf(out, "find_fit statistics not compiled in (build with "
+                 "-DMM_FIT_STATS)\n");
+#endif
 }
 
 /*
  * ---------------------------------------------------------------------------
- *                        BEGIN DEBUG HELPER FUNCTIONS
+ *                        END FIND_FIT STATISTICS
  * ---------------------------------------------------------------------------
  */
 
-static void print_linkedList() {
-    block_t *block;
-    int index;
-    for (index = 0; index < list_length; index++) {
-        printf("seg_list index = %d\n", index);
-        for (block = seg_list[index]; block != NULL; block = block->next) {
-            printf("alloc = %d\n", get_alloc(block));
-            printf("prev_alloc = %d\n", get_prev_alloc(block));
-            printf("size = %ld\n", get_size(block));
-        }
-    }
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN LATENCY HISTOGRAMS
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * When MM_LATENCY is defined, every public entry point (and extend_heap)
+ * reads a cycle counter on entry and exit and adds the difference to a
+ * log2 histogram for its operation and size class. Without MM_LATENCY
+ * latency_begin() returns 0 and latency_end() is empty, so no counter is
+ * read. As with the find_fit statistics, only the default heap is timed.
+ */
+#ifdef MM_LATENCY
+static mm_latency_snapshot_t latency;
+#endif
+
+#if defined(MM_TRACE) || defined(MM_THREADSAFE) || \
+    (defined(MM_LATENCY) && \
+     !(defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)))
+/**
+ * CLOCK_MONOTONIC in nanoseconds; used by the trace header, the lock wait
+ * times, and by read_ticks where there is no tick counter
+ */
+static uint64_t read_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
 }
+#endif
 
-static void print_heap() {
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0; block = find_next(block)) {
-        printf("alloc = %d\n", get_alloc(block));
-        printf("prev_alloc = %d\n", get_prev_alloc(block));
-        printf("size = %ld\n", get_size(block));
-    }
+#if defined(MM_LATENCY) || defined(MM_TRACE)
+/**
+ * read the tick counter: TSC on x86, the virtual counter on AArch64,
+ * and CLOCK_MONOTONIC nanoseconds anywhere else
+ */
+static uint64_t read_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return read_ns();
+#endif
 }
+#endif
 
-/********       The functions below are called in mm_checkheap      ********/
-static bool check_payload_align() {
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0; block = find_next(block)) {
-        if (get_alloc(block)) {
-            intptr_t payload_addr = (intptr_t)header_to_payload(block);
-            if (payload_addr % 16 != 0) {
-                return false;
-            }
-        }
-    }
-    return true;
+/**
+ * the tick counter shared by the latency histograms and the trace
+ * recorder, or 0 when neither is compiled in
+ */
+uint64_t mm_latency_now(void) {
+#if defined(MM_LATENCY) || defined(MM_TRACE)
+    return read_ticks();
+#else
+    return 0;
+#endif
 }
 
-static bool check_acyclic(block_t *free_list) {
-    if (free_list == NULL) {
-        return true;
+/**
+ * the size class of a request for `size` payload bytes; requests too large
+ * to adjust go in the largest class, as overflowing callocs do
+ */
+static int request_class(size_t size) {
+    if (size == 0) {
+        return 0;
     }
-    block_t *turtle = free_list;
-    block_t *rabbit = free_list->next;
-    while (turtle != rabbit) {
-        if (rabbit == NULL || rabbit->next == NULL) {
-            return true;
-        }
-        turtle = turtle->next;
-        rabbit = rabbit->next;
-        rabbit = rabbit->next;
+    if (size > (size_t)-1 - dsize - wsize) {
+        return MM_NUM_CLASSES - 1;
     }
-    return false;
+    return find_index(round_up(size + wsize, dsize));
 }
 
-static bool check_no_block_loss() {
-    int index;
-    size_t length = 0;
-    block_t *block1;
-    for (index = 0; index < list_length; index++) {
-        for (block1 = seg_list[index]; block1 != NULL; block1 = block1->next) {
-            length++;
-        }
-    }
+/**
+ * start timing an operation; returns the value to pass to latency_end
+ */
+static uint64_t latency_begin(void) {
+#ifdef MM_LATENCY
+    return read_ticks();
+#else
+    return 0;
+#endif
+}
 
-    block_t *block2;
-    size_t res = 0;
-    for (block2 = heap_start; get_size(block2) > 0;
-         block2 = find_next(block2)) {
-        if (!get_alloc(block2)) {
-            res++;
-        }
+/**
+ * finish timing operation `op` on size class `size_class`
+ */
+static void latency_end(mm_op_t op, int size_class, uint64_t start) {
+#ifdef MM_LATENCY
+    uint64_t ticks = read_ticks() - start;
+    int bucket = 0;
+    uint64_t rest = ticks;
+    if (cur_heap != &default_heap) {
+        return;
     }
-
-    // Check if these two counting matches
-    if (length == res) {
-        return true;
-    } else {
-        printf("Sum all free lists: %zu\n", length);
-        printf("Count by traversing heap: %zu\n", res);
-        return false;
+    while (rest != 0 && bucket < MM_LATENCY_BUCKETS - 1) {
+        rest >>= 1;
+        bucket++;
     }
+    latency.count[op][size_class]++;
+    latency.total[op][size_class] += ticks;
+    if (ticks > latency.max[op][size_class]) {
+        latency.max[op][size_class] = ticks;
+    }
+    latency.hist[op][size_class][bucket]++;
+#else
+    (void)op;
+    (void)size_class;
+    (void)start;
+#endif
 }
 
-static bool check_no_consecutive_free_blocks() {
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0; block = find_next(block)) {
-        block_t *next = find_next(block);
-        // if "next" is not the epilogue
-        if (get_size(next) > 0) {
-            bool is_cur_free = !get_alloc(block);
-            bool is_next_free = !get_alloc(next);
-            if (is_cur_free && is_next_free)
-                return false;
-        }
-    }
-    return true;
+/**
+ * clear the latency histograms
+ */
+void mm_latency_reset(void) {
+#ifdef MM_LATENCY
+    memset(&latency, 0, sizeof(latency));
+#endif
 }
 
-static bool check_epi_prologue() {
-    block_t *epilogue = (block_t *)((char *)mem_heap_hi() - 7);
-    bool epi = (get_alloc(epilogue)) && (get_size(epilogue) == 0);
-    block_t *prologue = (block_t *)((char *)mem_heap_lo());
-    bool pro = (get_alloc(prologue)) && (get_size(prologue) == 0);
-    return epi && pro;
+/**
+ * copy the latency histograms into `snap` and stamp it with the time
+ */
+void mm_latency_snapshot(mm_latency_snapshot_t *snap) {
+#ifdef MM_LATENCY
+    *snap = latency;
+#else
+    memset(snap, 0, sizeof(*snap));
+#endif
+    snap->taken_at = mm_latency_now();
 }
 
-static bool check_range() {
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0; block = find_next(block)) {
-        if (((intptr_t)block <= (intptr_t)(mem_heap_lo())) ||
-            ((intptr_t)block >= (intptr_t)(mem_heap_hi()) - 7)) {
-            return false;
+/**
+ * walk the histogram row(s) of `op` until `q` of the calls are covered and
+ * return the upper edge of that bucket
+ */
+uint64_t mm_latency_quantile(const mm_latency_snapshot_t *snap, mm_op_t op,
+                             int size_class, double q) {
+    int lo_class = (size_class < 0) ? 0 : size_class;
+    int hi_class = (size_class < 0) ? MM_NUM_CLASSES - 1 : size_class;
+    uint64_t count = 0;
+    uint64_t seen = 0;
+    int index;
+    int bucket;
+    for (index = lo_class; index <= hi_class; index++) {
+        count += snap->count[op][index];
+    }
+    if (count == 0) {
+        return 0;
+    }
+    for (bucket = 0; bucket < MM_LATENCY_BUCKETS; bucket++) {
+        for (index = lo_class; index <= hi_class; index++) {
+            seen += snap->hist[op][index][bucket];
+        }
+        if ((double)seen >= q * (double)count) {
+            break;
         }
     }
-    return true;
+    if (bucket >= MM_LATENCY_BUCKETS - 1) {
+        bucket = MM_LATENCY_BUCKETS - 1;
+    }
+    return (uint64_t)1 << bucket;
 }
 
-static bool check_free_list_consistent() {
-    block_t *block;
+/**
+ * print one line per (operation, size class) that has seen calls
+ */
+void mm_latency_dump(FILE *out) {
+#ifdef MM_LATENCY
+    static const char *const op_names[MM_NUM_OPS] = {
+        "malloc", "free", "realloc", "calloc", "extend_heap"};
+    mm_latency_snapshot_t *snap = &latency;
+    int op;
     int index;
-    for (index = 0; index < list_length; index++) {
-        for (block = seg_list[index]; block != NULL; block = block->next) {
-            if (block->next != NULL) {
-                if (block->next->prev != block) {
-                    return false;
-                }
+    fprintf(out, "%-12s %5s %12s %10s %10s %10s %10s %12s\n", "op", "class",
+            "count", "mean", "p50", "p99", "p99.9", "max");
+    for (op = 0; op < MM_NUM_OPS; op++) {
+        for (index = 0; index < MM_NUM_CLASSES; index++) {
+            uint64_t count = snap->count[op][index];
+            if (count == 0) {
+                continue;
             }
+            fprintf(out,
+                    "%-12s %5d %12" PRIu64 " %10.1f %10" PRIu64 " %10" PRIu64
+                    " %10" PRIu64 " %12" PRIu64 "\n",
+                    op_names[op], index, count,
+                    (double)snap->total[op][index] / (double)count,
+                    mm_latency_quantile(snap, (mm_op_t)op, index, 0.5),
+                    mm_latency_quantile(snap, (mm_op_t)op, index, 0.99),
+                    mm_latency_quantile(snap, (mm_op_t)op, index, 0.999),
+                    snap->max[op][index]);
         }
     }
-    return true;
+#else
+    fprintf(out, "latency histograms not compiled in (build with "
+                 "-DMM_LATENCY)\n");
+#endif
 }
 
-static bool check_free_list_size_range() {
-    block_t *block;
-    int index;
-    size_t lo;
-    size_t hi;
-    for (index = 0; index < list_length; index++) {
-        if (index == 0) {
-            lo = list0;
-            hi = list1;
-        } else if (index == 1) {
-            lo = list1;
-            hi = list2;
-        } else if (index == 2) {
-            lo = list2;
-            hi = list3;
-        } else if (index == 3) {
-            lo = list3;
-            hi = list4;
-        } else if (index == 4) {
-            lo = list4;
-            hi = list5;
-        } else if (index == 5) {
-            lo = list5;
-            hi = list6;
-        } else if (index == 6) {
-            lo = list6;
-            hi = list7;
-        } else if (index == 7) {
-            lo = list7;
-            hi = list8;
-        } else if (index == 8) {
-            lo = list8;
-            hi = list9;
-        } else if (index == 9) {
-            lo = list9;
-            hi = list10;
-        } else if (index == 10) {
-            lo = list10;
-            hi = list11;
-        } else if (index == 11) {
-            lo = list11;
-            hi = list12;
-        } else if (index == 12) {
-            lo = list12;
-            hi = list13;
-        } else if (index == 13) {
-            lo = list13;
-            hi = list14;
-        } else {
-            lo = list14;
-            hi = 0xffffffffffffffff;
-        }
-        for (block = seg_list[index]; block != NULL; block = block->next) {
-            size_t size = get_size(block);
-            if (size < lo || size >= hi) {
-                return false;
-            }
-        }
+/*
+ * ---------------------------------------------------------------------------
+ *                        END LATENCY HISTOGRAMS
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * append `value` to `p` as an unsigned LEB128 varint (used by the trace
+ * recorder and by mm_snapshot)
+ */
+static unsigned char *put_varint(unsigned char *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (unsigned char)(value | 0x80);
+        value >>= 7;
     }
-    return true;
+    *p++ = (unsigned char)value;
+    return p;
 }
 
-static bool check_free_list_pointer_range() {
-    block_t *block;
-    int index;
-    for (index = 0; index < list_length; index++) {
-        for (block = seg_list[index]; block != NULL; block = block->next) {
-            if (block->prev != NULL) {
-                if (((intptr_t)block->prev <= (intptr_t)(mem_heap_lo())) ||
-                    ((intptr_t)block->prev >= (intptr_t)(mem_heap_hi()) - 7)) {
-                    return false;
-                }
-            }
-            if (block->next != NULL) {
-                if (((intptr_t)block->next <= (intptr_t)(mem_heap_lo())) ||
-                    ((intptr_t)block->next >= (intptr_t)(mem_heap_hi()) - 7)) {
-                    return false;
-                }
-            }
-        }
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN TRACE RECORDER
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * When MM_TRACE is defined, every public call is appended to a ring buffer
+ * owned by the calling thread. Recording is a relaxed check of trace_fd,
+ * one tick counter read and a handful of stores; the only shared write is
+ * the release store of the ring's head.
+ *
+ * Each ring has exactly one producer (its thread) and one consumer (whoever
+ * holds trace_lock), so head and tail need no read-modify-write. A
+ * producer that finds its ring full drains it itself under trace_lock.
+ * Draining varint-encodes the events into trace_buf and writes them to the
+ * trace file as a records chunk (see mm_trace.h).
+ *
+ * Rings are mmap'ed so that recording never calls back into the allocator,
+ * and stay registered after their thread exits; whatever they still hold
+ * is written on the next flush. Calls that race with mm_trace_stop may be
+ * dropped.
+ */
+#ifdef MM_TRACE
+/** @brief Events per thread ring (a power of two) */
+#define TRACE_RING_SIZE 4096
+
+/** @brief Bytes of trace_buf, the staging buffer for file writes */
+#define TRACE_BUF_SIZE (64 * 1024)
+
+/** @brief Upper bound on the encoded size of a chunk header or event */
+#define TRACE_MAX_ENCODED 48
+
+typedef struct trace_event {
+    uint64_t time;
+    uint64_t size;
+    uint64_t arg;    // offset + 1 of the pointer passed in, or elements
+    uint64_t result; // offset + 1 of the pointer returned
+    uint8_t op;
+} trace_event_t;
+
+typedef struct trace_ring {
+    struct trace_ring *next_ring; // registry link
+    uint32_t thread;
+    _Atomic uint64_t head; // events ever recorded; owner writes
+    _Atomic uint64_t tail; // events ever drained; trace_lock holder writes
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static _Atomic int trace_fd = -1;
+static _Atomic(trace_ring_t *) trace_rings = NULL;
+static _Atomic uint32_t trace_threads = 0;
+static __thread trace_ring_t *trace_ring = NULL;
+
+/* The staging buffer and the file are protected by trace_lock */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char trace_buf[TRACE_BUF_SIZE];
+static size_t trace_buf_used = 0;
+
+/**
+ * give the calling thread a ring and add it to the registry
+ */
+static trace_ring_t *trace_register(void) {
+    trace_ring_t *ring = mmap(NULL, sizeof(trace_ring_t),
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return NULL;
     }
-    return true;
+    ring->thread = atomic_fetch_add(&trace_threads, 1);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->next_ring = atomic_load(&trace_rings);
+    while (!atomic_compare_exchange_weak(&trace_rings, &ring->next_ring,
+                                         ring)) {
+    }
+    trace_ring = ring;
+    return ring;
 }
 
-static bool check_curr_next_consistency() {
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0; block = find_next(block)) {
-        block_t *next = find_next(block);
-        // if "next" is not the epilogue
-        if (get_size(next) > 0) {
-            if (get_prev_alloc(next) != get_alloc(block)) {
-                return false;
-            }
+/**
+ * write out the staging buffer (trace_lock held)
+ */
+static void trace_write_buf(void) {
+    int fd = atomic_load_explicit(&trace_fd, memory_order_relaxed);
+    size_t done = 0;
+    while (fd >= 0 && done < trace_buf_used) {
+        ssize_t n = write(fd, trace_buf + done, trace_buf_used - done);
+        if (n <= 0) {
+            break;
         }
+        done += (size_t)n;
     }
-    return true;
+    trace_buf_used = 0;
 }
 
-static bool check_header_footer_consistency() {
-    block_t *block;
-    for (block = heap_start; get_size(block) > 0; block = find_next(block)) {
-        if (!get_alloc(block)) {
-            word_t *ptr_to_header = &block->header;
-            word_t *ptr_to_footer = header_to_footer(block);
-            // compare
-            if (*ptr_to_header != *ptr_to_footer) {
-                return false;
-            }
-        }
+/**
+ * make room for one more header or event in the staging buffer
+ */
+static unsigned char *trace_reserve(void) {
+    if (trace_buf_used + TRACE_MAX_ENCODED > TRACE_BUF_SIZE) {
+        trace_write_buf();
     }
-    return true;
+    return trace_buf + trace_buf_used;
 }
+
 /**
- * @brief
- *
- * <What does this function do?>
- * <What are the function's arguments?>
- * <What is the function's return value?>
- * <Are there any preconditions or postconditions?>
- *
- * @param[in] line
- * @return
+ * encode everything between the ring's tail and head as one records chunk
+ * (trace_lock held)
  */
-bool mm_checkheap(int line) {
-    bool errorflag = true;
-    if (!check_payload_align()) {
-        printf("payload not aligned\n");
-        errorflag = false;
+static void trace_drain(trace_ring_t *ring) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t time;
+    uint64_t seq;
+    unsigned char *p;
+    if (tail == head) {
+        return;
     }
-
-    int index;
-    for (index = 0; index < list_length; index++) {
-        if (!check_acyclic(seg_list[index])) {
-            printf("free list cyclic\n");
-            errorflag = false;
+    time = ring->events[tail & (TRACE_RING_SIZE - 1)].time;
+    p = trace_reserve();
+    *p++ = MM_TRACE_CHUNK_RECORDS;
+    p = put_varint(p, ring->thread);
+    p = put_varint(p, tail);
+    p = put_varint(p, time);
+    p = put_varint(p, head - tail);
+    trace_buf_used = (size_t)(p - trace_buf);
+    for (seq = tail; seq != head; seq++) {
+        trace_event_t *event = &ring->events[seq & (TRACE_RING_SIZE - 1)];
+        p = trace_reserve();
+        *p++ = event->op;
+        switch (event->op) {
+        case MM_OP_MALLOC:
+            p = put_varint(p, event->size);
+            p = put_varint(p, event->result);
+            break;
+        case MM_OP_FREE:
+            p = put_varint(p, event->arg);
+            break;
+        case MM_OP_REALLOC:
+            p = put_varint(p, event->arg);
+            p = put_varint(p, event->size);
+            p = put_varint(p, event->result);
+            break;
+        default: // MM_OP_CALLOC
+            p = put_varint(p, event->arg);
+            p = put_varint(p, event->size);
+            p = put_varint(p, event->result);
+            break;
         }
+        p = put_varint(p, event->time - time);
+        time = event->time;
+        trace_buf_used = (size_t)(p - trace_buf);
     }
+    atomic_store_explicit(&ring->tail, head, memory_order_release);
+}
 
-    if (!check_epi_prologue()) {
-        printf("bad epilogue or prologue blocks\n");
-        errorflag = false;
+/**
+ * drain every ring (trace_lock held); if `discard`, drop the events instead
+ */
+static void trace_drain_all(bool discard) {
+    trace_ring_t *ring;
+    for (ring = atomic_load(&trace_rings); ring != NULL;
+         ring = ring->next_ring) {
+        if (discard) {
+            atomic_store(&ring->tail, atomic_load(&ring->head));
+        } else {
+            trace_drain(ring);
+        }
     }
+}
 
-    if (!check_range()) {
-        printf("block address out of range\n");
-        errorflag = false;
+/**
+ * add a clock calibration chunk (trace_lock held)
+ */
+static void trace_clock(void) {
+    unsigned char *p = trace_reserve();
+    *p++ = MM_TRACE_CHUNK_CLOCK;
+    p = put_varint(p, read_ticks());
+    p = put_varint(p, read_ns());
+    trace_buf_used = (size_t)(p - trace_buf);
+}
+
+/**
+ * encode a pointer into the heap as offset + 1, NULL as 0
+ */
+static uint64_t trace_offset(const void *ptr) {
+    if (ptr == NULL) {
+        return 0;
     }
+    return (uint64_t)((const char *)ptr - (char *)mem_heap_lo()) + 1;
+}
+#endif /* MM_TRACE */
 
-    if (!check_free_list_consistent()) {
-        printf("block->next->prev != block\n");
-        errorflag = false;
+/**
+ * record one public call; `arg` is the pointer passed in (free, realloc)
+ * and `result` the pointer returned
+ */
+static void trace_record(mm_op_t op, size_t size, size_t elements,
+                         const void *arg, const void *result) {
+#ifdef MM_TRACE
+    trace_ring_t *ring = trace_ring;
+    trace_event_t *event;
+    uint64_t head;
+    if (atomic_load_explicit(&trace_fd, memory_order_relaxed) < 0) {
+        return;
+    }
+    if (ring == NULL && (ring = trace_register()) == NULL) {
+        return;
+    }
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) ==
+        TRACE_RING_SIZE) {
+        pthread_mutex_lock(&trace_lock);
+        trace_drain(ring);
+        pthread_mutex_unlock(&trace_lock);
     }
+    event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    event->time = read_ticks();
+    event->size = size;
+    event->arg = (op == MM_OP_CALLOC) ? elements : trace_offset(arg);
+    event->result = trace_offset(result);
+    event->op = (uint8_t)op;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+#else
+    (void)op;
+    (void)size;
+    (void)elements;
+    (void)arg;
+    (void)result;
+#endif
+}
 
-    if (!check_free_list_size_range()) {
-        printf("block size is out of the size range of the block list it "
-               "belongs to\n");
-        errorflag = false;
+/**
+ * open `path` and start recording into it
+ */
+bool mm_trace_start(const char *path) {
+#ifdef MM_TRACE
+    static const unsigned char magic[] = {'M', 'M', 'T', 'R',
+                                          MM_TRACE_VERSION};
+    int fd;
+    bool ok = false;
+    pthread_mutex_lock(&trace_lock);
+    if (atomic_load(&trace_fd) < 0) {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            trace_drain_all(true); // leftovers of an earlier recording
+            atomic_store(&trace_fd, fd);
+            memcpy(trace_buf, magic, sizeof(magic));
+            trace_buf_used = sizeof(magic);
+            trace_clock();
+            trace_write_buf();
+            ok = true;
+        }
     }
+    pthread_mutex_unlock(&trace_lock);
+    return ok;
+#else
+    (void)path;
+    return false;
+#endif
+}
 
-    if (!check_free_list_pointer_range()) {
-        printf("block->prev / block->next address out of range\n");
-        errorflag = false;
+/**
+ * write everything recorded so far to the trace file
+ */
+void mm_trace_flush(void) {
+#ifdef MM_TRACE
+    pthread_mutex_lock(&trace_lock);
+    if (atomic_load(&trace_fd) >= 0) {
+        trace_drain_all(false);
+        trace_write_buf();
     }
+    pthread_mutex_unlock(&trace_lock);
+#endif
+}
 
-    if (!check_header_footer_consistency()) {
-        printf(
-            "for some free blocks, the header and footer are inconsistent\n");
-        errorflag = false;
+/**
+ * flush, add a final clock chunk and close the trace file
+ */
+void mm_trace_stop(void) {
+#ifdef MM_TRACE
+    int fd;
+    pthread_mutex_lock(&trace_lock);
+    fd = atomic_load(&trace_fd);
+    if (fd >= 0) {
+        trace_drain_all(false);
+        trace_clock();
+        trace_write_buf();
+        atomic_store(&trace_fd, -1);
+        close(fd);
     }
+    pthread_mutex_unlock(&trace_lock);
+#endif
+}
 
-    if (!check_curr_next_consistency()) {
-        printf("the alloc info of some block is inconsistent with the prev "
-               "alloc info of its following block\n");
-        errorflag = false;
+/*
+ * ---------------------------------------------------------------------------
+ *                        END TRACE RECORDER
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN HEAP LOCK
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * When MM_THREADSAFE is defined (MM_PRELOAD defines it too), malloc, free,
+ * realloc, calloc and the other public calls on the default heap may come
+ * from any thread, so each of them runs under heap_lock, which covers
+ * seg_list, heap_start and extend_heap as well as the latency histograms.
+ * Otherwise the allocator is single-threaded, as the driver expects, and
+ * heap_lock and heap_unlock are empty.
+ *
+ * The lock is one word: 0 when free, 1 when held, 2 when held and a
+ * thread may be asleep on it. A thread that finds it held spins for a
+ * while, since most critical sections are short, and then sleeps on the
+ * word with futex. As in glibc's adaptive mutexes, the spin limit follows
+ * a running average of how long recent acquisitions spun, so spinning
+ * stops paying for itself less often than a fixed limit would.
+ *
+ * The holder counts acquisitions, contended acquisitions (those that did
+ * not get the lock at the first try), those of them that slept, and the
+ * time they waited, for mm_lock_stats. Only the holder writes the
+ * counters, with relaxed loads and stores, so mm_lock_stats can read them
+ * without taking the lock.
+ */
+#ifdef MM_THREADSAFE
+/** @brief Most spins before sleeping */
+#define LOCK_MAX_SPINS 200
+
+static _Atomic uint32_t heap_lock_word;
+static _Atomic int heap_lock_spins; // running average, written by the holder
+
+static struct {
+    _Atomic uint64_t acquisitions;
+    _Atomic uint64_t contended;
+    _Atomic uint64_t sleeps;
+    _Atomic uint64_t wait_ns;
+} lock_stats;
+
+/**
+ * add `n` to a counter written only by the lock holder
+ */
+static void lock_count(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * the contended path of heap_lock: spin, then sleep until the lock is ours
+ */
+static void heap_lock_slow(void) {
+    uint64_t start = read_ns();
+    int max_spins =
+        2 * atomic_load_explicit(&heap_lock_spins, memory_order_relaxed) + 10;
+    int average;
+    int spins = 0;
+    bool slept = false;
+    uint32_t c;
+
+    if (max_spins > LOCK_MAX_SPINS) {
+        max_spins = LOCK_MAX_SPINS;
+    }
+    for (;;) {
+        c = 0;
+        if (atomic_load_explicit(&heap_lock_word, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_weak_explicit(&heap_lock_word, &c, 1,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed)) {
+            break;
+        }
+        if (++spins >= max_spins) {
+            // Mark the lock as having a sleeper, then sleep while it is held
+            while (atomic_exchange_explicit(&heap_lock_word, 2,
+                                            memory_order_acquire) != 0) {
+                syscall(SYS_futex, &heap_lock_word, FUTEX_WAIT_PRIVATE, 2,
+                        NULL, NULL, 0);
+                slept = true;
+            }
+            break;
+        }
+        cpu_relax();
     }
 
-    if (!check_no_consecutive_free_blocks()) {
-        printf("exist consecutive free blocks\n");
-        errorflag = false;
+    average = atomic_load_explicit(&heap_lock_spins, memory_order_relaxed);
+    atomic_store_explicit(&heap_lock_spins, average + (spins - average) / 8,
+                          memory_order_relaxed);
+    lock_count(&lock_stats.acquisitions, 1);
+    lock_count(&lock_stats.contended, 1);
+    lock_count(&lock_stats.sleeps, slept ? 1 : 0);
+    lock_count(&lock_stats.wait_ns, read_ns() - start);
+}
+#endif /* MM_THREADSAFE */
+
+/**
+ * take the default heap's lock
+ */
+static void heap_lock(void) {
+#ifdef MM_THREADSAFE
+    uint32_t c = 0;
+    if (atomic_compare_exchange_strong_explicit(&heap_lock_word, &c, 1,
+                                                memory_order_acquire,
+                                                memory_order_relaxed)) {
+        lock_count(&lock_stats.acquisitions, 1);
+        return;
     }
+    heap_lock_slow();
+#endif
+}
 
-    if (!check_no_block_loss()) {
-        printf("block loss\n");
-        errorflag = false;
+/**
+ * release the default heap's lock, waking one sleeper if there may be one
+ */
+static void heap_unlock(void) {
+#ifdef MM_THREADSAFE
+    if (atomic_exchange_explicit(&heap_lock_word, 0, memory_order_release) ==
+        2) {
+        syscall(SYS_futex, &heap_lock_word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL,
+                0);
     }
+#endif
+}
 
-    // print_heap();
-    // print_linkedList();
-    return errorflag;
+/**
+ * copy the lock counters into `stats`
+ */
+void mm_lock_stats(mm_lock_stats_t *stats) {
+#ifdef MM_THREADSAFE
+    stats->acquisitions =
+        atomic_load_explicit(&lock_stats.acquisitions, memory_order_relaxed);
+    stats->contended =
+        atomic_load_explicit(&lock_stats.contended, memory_order_relaxed);
+    stats->sleeps =
+        atomic_load_explicit(&lock_stats.sleeps, memory_order_relaxed);
+    stats->wait_ns =
+        atomic_load_explicit(&lock_stats.wait_ns, memory_order_relaxed);
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+/**
+ * clear the lock counters
+ */
+void mm_lock_stats_reset(void) {
+#ifdef MM_THREADSAFE
+    heap_lock();
+    atomic_store_explicit(&lock_stats.acquisitions, 0, memory_order_relaxed);
+    atomic_store_explicit(&lock_stats.contended, 0, memory_order_relaxed);
+    atomic_store_explicit(&lock_stats.sleeps, 0, memory_order_relaxed);
+    atomic_store_explicit(&lock_stats.wait_ns, 0, memory_order_relaxed);
+    heap_unlock();
+#endif
+}
+
+/**
+ * print the lock counters
+ */
+void mm_lock_stats_dump(FILE *out) {
+#ifdef MM_THREADSAFE
+    mm_lock_stats_t stats;
+    mm_lock_stats(&stats);
+    fprintf(out,
+            "heap lock: acquisitions %" PRIu64 " contended %" PRIu64
+            " (%.2f%%) slept %" PRIu64 " wait %" PRIu64 " ns",
+            stats.acquisitions, stats.contended,
+            stats.acquisitions == 0
+                ? 0.0
+                : 100.0 * (double)stats.contended / (double)stats.acquisitions,
+            stats.sleeps, stats.wait_ns);
+    if (stats.contended != 0) {
+        fprintf(out, " (%.1f ns per contended acquisition)",
+                (double)stats.wait_ns / (double)stats.contended);
+    }
+    fprintf(out, "\n");
+#else
+    fprintf(out, "heap lock statistics not compiled in (build with "
+                 "-DMM_THREADSAFE)\n");
+#endif
 }
 
 /*
  * ---------------------------------------------------------------------------
- *                        END DEBUG HELPER FUNCTIONS
+ *                        END HEAP LOCK
  * ---------------------------------------------------------------------------
  */
 
@@ -971,32 +1649,38 @@ bool mm_checkheap(int line) {
  * <What is the function's return value?>
  * <Are there any preconditions or postconditions?>
  *
+ * @param[in] size
  * @return
  */
-bool mm_init(void) {
-    // Create the initial empty heap
-    word_t *start = (word_t *)(mem_sbrk(2 * wsize));
+static block_t *extend_heap(size_t size) {
+    void *bp;
+    uint64_t start = latency_begin();
 
-    if (start == (void *)-1) {
-        return false;
+    // Allocate an even number of words to maintain alignment
+    size = round_up(size, dsize);
+    if ((bp = heap_sbrk((intptr_t)size)) == (void *)-1) {
+        latency_end(MM_OP_EXTEND_HEAP, find_index(size), start);
+        return NULL;
     }
 
-    start[0] = pack(0, true, true); // Heap prologue (block footer)
-    start[1] = pack(0, true, true); // Heap epilogue (block header)
+    // Initialize free block header/footer
+    block_t *block = payload_to_header(bp);
+    write_block(block, size, false, get_prev_alloc(block));
 
-    // Heap starts with first "block header", currently the epilogue
-    heap_start = (block_t *)&(start[1]);
+    // Create new epilogue header
+    block_t *block_next = find_next(block);
+    write_epilogue(block_next);
 
-    int index;
-    for (index = 0; index < list_length; index++) {
-        seg_list[index] = NULL;
-    }
+    // Coalesce in case the previous block was free
+    block = coalesce_block(block);
+    add_to_list(block);
 
-    // Extend the empty heap with a free block of chunksize bytes
-    if (extend_heap(chunksize) == NULL) {
-        return false;
-    }
-    return true;
+    // printf("printing linkedList in extend heap\n...");
+    // print_linkedList();
+
+    dbg_checkheap(__LINE__);
+    latency_end(MM_OP_EXTEND_HEAP, find_index(size), start);
+    return block;
 }
 
 /**
@@ -1007,177 +1691,3016 @@ bool mm_init(void) {
  * <What is the function's return value?>
  * <Are there any preconditions or postconditions?>
  *
- * @param[in] size
+ * @param[in] block
+ * @param[in] asize
+ */
+static void split_block(block_t *block, size_t asize) {
+    dbg_requires(asize % dsize == 0);
+    /* TODO: Can you write a precondition about the value of asize? */
+    remove_from_list(block);
+    size_t block_size = get_size(block);
+
+    if ((block_size - asize) >= min_block_size) {
+        block_t *block_next;
+        write_block(block, asize, true, get_prev_alloc(block));
+
+        block_next = find_next(block);
+        write_block(block_next, block_size - asize, false, true);
+        add_to_list(block_next);
+    } else {
+        write_block(block, block_size, true, get_prev_alloc(block));
+        update_next_prev_alloc(block, true);
+    }
+
+    dbg_touch(block);
+    dbg_ensures(get_alloc(block));
+}
+
+/**
+ * @brief
+ *
+ * <What does this function do?>
+ * <What are the function's arguments?>
+ * <What is the function's return value?>
+ * <Are there any preconditions or postconditions?>
+ *
+ * @param[in] asize
+ * @param[in] first_index find_index(asize), the first bin to search
  * @return
  */
-void *malloc(size_t size) {
-    size_t asize;      // Adjusted block size
-    size_t extendsize; // Amount to extend heap if no fit is found
-    block_t *block;
-    void *bp = NULL;
+static block_t *find_fit(size_t asize, int first_index) {
+    block_t *block;
+    int index;
+    size_t nodes = 0; // only used by the fit statistics
+    for (index = first_index; index < list_length; index++) {
+        size_t bin_start = nodes;
+        block = cur_heap->seg_list[index];
+        while (block != NULL) {
+            nodes++;
+            if (!(get_alloc(block)) && (asize <= get_size(block))) {
+                fit_stats_walked(index, nodes - bin_start);
+                fit_stats_record(first_index, index, nodes);
+                return block;
+            }
+            block = list_next(block);
+        }
+        fit_stats_walked(index, nodes - bin_start);
+    }
+    fit_stats_record(first_index, list_length, nodes);
+    return NULL;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN DEBUG HELPER FUNCTIONS
+ * ---------------------------------------------------------------------------
+ */
+
+static void print_linkedList() {
+    block_t *block;
+    int index;
+    for (index = 0; index < list_length; index++) {
+        printf("seg_list index = %d\n", index);
+        for (block = cur_heap->seg_list[index]; block != NULL;
+             block = list_next(block)) {
+            printf("alloc = %d\n", get_alloc(block));
+            printf("prev_alloc = %d\n", get_prev_alloc(block));
+            printf("size = %ld\n", get_size(block));
+        }
+    }
+}
+
+static void print_heap() {
+    block_t *block;
+    for (block = cur_heap->heap_start; get_size(block) > 0;
+         block = find_next(block)) {
+        printf("alloc = %d\n", get_alloc(block));
+        printf("prev_alloc = %d\n", get_prev_alloc(block));
+        printf("size = %ld\n", get_size(block));
+    }
+}
+
+/********       The functions below are called in mm_checkheap      ********/
+
+/*
+ * Every check of mm_checkheap used to walk the heap or the free lists on
+ * its own. They are now fused into one walk of the heap and one walk of
+ * each free list, which record what they find here; mm_checkheap then
+ * reports in the order the separate checks did.
+ */
+typedef struct check_report {
+    bool payload_align;       // every allocated payload is 16-byte aligned
+    bool range;               // every block lies inside the heap
+    bool header_footer;       // free blocks: header == footer
+    bool curr_next;           // alloc bit == next block's prev_alloc bit
+    bool no_consecutive_free; // no two free blocks are adjacent
+    size_t heap_free_blocks;  // free blocks met walking the heap
+    bool acyclic[15];         // seg_list[i] has no cycle
+    bool list_consistent;     // block->next->prev == block
+    bool list_size_range;     // block sizes fit their list
+    bool list_pointer_range;  // next and prev lie inside the heap
+    size_t list_free_blocks;  // blocks on all free lists
+    // where a heap walk started, ended and stopped, to stitch ranges
+    block_t *first;           // first block walked, NULL if none
+    block_t *last;            // last block walked
+    block_t *stop;            // the block the walk stopped at
+} check_report_t;
+
+/**
+ * @brief Sets every invariant of `report` to holding, with no blocks seen.
+ */
+static void check_report_init(check_report_t *report) {
+    int index;
+    memset(report, 0, sizeof(*report));
+    report->payload_align = report->range = report->header_footer = true;
+    report->curr_next = report->no_consecutive_free = true;
+    report->list_consistent = report->list_size_range = true;
+    report->list_pointer_range = true;
+    for (index = 0; index < list_length; index++) {
+        report->acyclic[index] = true;
+    }
+}
+
+/**
+ * @brief Walks the heap once from `start` up to `end` (or to the
+ *        epilogue if `end` is NULL), doing the work of the old payload
+ *        alignment, range, header/footer, prev_alloc, coalescing and
+ *        free-block-count walks.
+ */
+static void check_heap_range(block_t *start, block_t *end,
+                             check_report_t *report) {
+    intptr_t lo = (intptr_t)heap_lo();
+    intptr_t hi = (intptr_t)heap_hi() - 7;
+    block_t *prev = NULL;
+    block_t *block;
+    for (block = start; (end == NULL || block < end) && get_size(block) > 0;
+         block = find_next(block)) {
+        bool alloc = get_alloc(block);
+        if (alloc && (intptr_t)header_to_payload(block) % 16 != 0) {
+            report->payload_align = false;
+        }
+        if ((intptr_t)block <= lo || (intptr_t)block >= hi) {
+            report->range = false;
+        }
+        if (!alloc) {
+            if (block->header != *header_to_footer(block)) {
+                report->header_footer = false;
+            }
+            report->heap_free_blocks++;
+        }
+        // the pair (prev, block) is the old (block, next) pair whose next
+        // is not the epilogue
+        if (prev != NULL) {
+            if (get_prev_alloc(block) != get_alloc(prev)) {
+                report->curr_next = false;
+            }
+            if (!alloc && !get_alloc(prev)) {
+                report->no_consecutive_free = false;
+            }
+        } else {
+            report->first = block;
+        }
+        prev = block;
+    }
+    report->last = prev;
+    report->stop = block;
+}
+
+/**
+ * @brief Walks seg_list[index] once, doing the work of the old cycle,
+ *        next->prev, size range, pointer range and block-count walks.
+ *
+ * A tortoise trails the walk at half speed; if the walk ever lands on
+ * it, the list is cyclic and the walk stops there instead of looping.
+ */
+static void check_free_list(int index, check_report_t *report) {
+    intptr_t lo = (intptr_t)heap_lo();
+    intptr_t hi = (intptr_t)heap_hi() - 7;
+    block_t *tortoise = cur_heap->seg_list[index];
+    size_t steps = 0;
+    size_t min_size, max_size;
+    block_t *block;
+    list_bounds(index, &min_size, &max_size);
+    for (block = cur_heap->seg_list[index]; block != NULL;
+         block = list_next(block)) {
+        size_t size = get_size(block);
+        if (steps > 0 && block == tortoise) {
+            report->acyclic[index] = false;
+            break;
+        }
+        block_t *next = list_next(block);
+        block_t *prev = list_prev(block);
+        if (next != NULL && list_prev(next) != block) {
+            report->list_consistent = false;
+        }
+        if (size < min_size || size >= max_size) {
+            report->list_size_range = false;
+        }
+        if (prev != NULL && ((intptr_t)prev <= lo || (intptr_t)prev >= hi)) {
+            report->list_pointer_range = false;
+        }
+        if (next != NULL && ((intptr_t)next <= lo || (intptr_t)next >= hi)) {
+            report->list_pointer_range = false;
+        }
+        report->list_free_blocks++;
+        if (++steps % 2 == 0) {
+            tortoise = list_next(tortoise);
+        }
+    }
+}
+
+static bool check_epi_prologue() {
+    block_t *epilogue = (block_t *)(heap_hi() - 7);
+    bool epi = (get_alloc(epilogue)) && (get_size(epilogue) == 0);
+    block_t *prologue = (block_t *)heap_lo();
+    bool pro = (get_alloc(prologue)) && (get_size(prologue) == 0);
+    return epi && pro;
+}
+
+#ifdef MM_PARALLEL_CHECK
+/**
+ * @brief Folds the findings of one walk into `into`.
+ */
+static void check_report_merge(check_report_t *into,
+                               const check_report_t *from) {
+    int index;
+    into->payload_align = into->payload_align && from->payload_align;
+    into->range = into->range && from->range;
+    into->header_footer = into->header_footer && from->header_footer;
+    into->curr_next = into->curr_next && from->curr_next;
+    into->no_consecutive_free =
+        into->no_consecutive_free && from->no_consecutive_free;
+    into->heap_free_blocks += from->heap_free_blocks;
+    for (index = 0; index < list_length; index++) {
+        into->acyclic[index] = into->acyclic[index] && from->acyclic[index];
+    }
+    into->list_consistent = into->list_consistent && from->list_consistent;
+    into->list_size_range = into->list_size_range && from->list_size_range;
+    into->list_pointer_range =
+        into->list_pointer_range && from->list_pointer_range;
+    into->list_free_blocks += from->list_free_blocks;
+}
+#endif /* MM_PARALLEL_CHECK */
+
+/**
+ * @brief Prints a line for every invariant that does not hold (one
+ *        "free list cyclic" per cyclic list), in a fixed order, so that
+ *        the output of two runs can be compared.
+ * @return true if every invariant holds
+ */
+static bool check_report_print(const check_report_t *report) {
+    bool errorflag = true;
+    int index;
+
+    if (!report->payload_align) {
+        printf("payload not aligned\n");
+        errorflag = false;
+    }
+
+    for (index = 0; index < list_length; index++) {
+        if (!report->acyclic[index]) {
+            printf("free list cyclic\n");
+            errorflag = false;
+        }
+    }
+
+    if (!check_epi_prologue()) {
+        printf("bad epilogue or prologue blocks\n");
+        errorflag = false;
+    }
+
+    if (!report->range) {
+        printf("block address out of range\n");
+        errorflag = false;
+    }
+
+    if (!report->list_consistent) {
+        printf("block->next->prev != block\n");
+        errorflag = false;
+    }
+
+    if (!report->list_size_range) {
+        printf("block size is out of the size range of the block list it "
+               "belongs to\n");
+        errorflag = false;
+    }
+
+    if (!report->list_pointer_range) {
+        printf("block->prev / block->next address out of range\n");
+        errorflag = false;
+    }
+
+    if (!report->header_footer) {
+        printf(
+            "for some free blocks, the header and footer are inconsistent\n");
+        errorflag = false;
+    }
+
+    if (!report->curr_next) {
+        printf("the alloc info of some block is inconsistent with the prev "
+               "alloc info of its following block\n");
+        errorflag = false;
+    }
+
+    if (!report->no_consecutive_free) {
+        printf("exist consecutive free blocks\n");
+        errorflag = false;
+    }
+
+    if (report->list_free_blocks != report->heap_free_blocks) {
+        printf("Sum all free lists: %zu\n", report->list_free_blocks);
+        printf("Count by traversing heap: %zu\n", report->heap_free_blocks);
+        printf("block loss\n");
+        errorflag = false;
+    }
+
+    return errorflag;
+}
+
+/**
+ * @brief Checks the heap and the free lists for consistency.
+ *
+ * Makes one pass over the heap and one over each free list, then reports
+ * with check_report_print.
+ *
+ * @param[in] line The caller's line number, for breakpoints
+ * @return true if every invariant holds
+ */
+bool mm_checkheap(int line) {
+    check_report_t report;
+    int index;
+
+    check_report_init(&report);
+    check_heap_range(cur_heap->heap_start, NULL, &report);
+    for (index = 0; index < list_length; index++) {
+        check_free_list(index, &report);
+    }
+
+    // print_heap();
+    // print_linkedList();
+    return check_report_print(&report);
+}
+
+/*
+ * Parallel checking. The heap is implicit, so a block boundary cannot be
+ * told from payload bytes by looking at memory alone. Free-list nodes
+ * are boundaries, though, so the ranges are split at free blocks sampled
+ * from seg_list, spread out by address. Each range and each free list is
+ * then checked by whichever thread takes it first. The range summaries
+ * are stitched together at the split points, which catches a bad
+ * prev_alloc bit or two adjacent free blocks straddling a split. If a
+ * range walk overruns its split point, the split point was not a block
+ * after all and the check is redone serially.
+ */
+#ifdef MM_PARALLEL_CHECK
+
+/** @brief Most ranges the heap is split into */
+#define CHECK_MAX_RANGES 64
+
+/** @brief Most free blocks sampled as split point candidates */
+#define CHECK_SAMPLES 1024
+
+/** @brief The work shared by the checking threads */
+typedef struct check_job {
+    _Atomic int next_task; // ranges first, then free lists
+    int nranges;
+    block_t *starts[CHECK_MAX_RANGES + 1]; // starts[nranges] is NULL
+    check_report_t reports[CHECK_MAX_RANGES + 15];
+} check_job_t;
+
+static int compare_blocks(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(block_t *const *)a;
+    uintptr_t y = (uintptr_t)*(block_t *const *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Picks up to `nranges` - 1 split points among the free blocks
+ *        and returns the number of ranges.
+ */
+static int check_split_heap(check_job_t *job, int nranges) {
+    static block_t *samples[CHECK_SAMPLES];
+    intptr_t lo = (intptr_t)heap_lo();
+    intptr_t hi = (intptr_t)heap_hi() - 7;
+    int per_list = CHECK_SAMPLES / list_length;
+    int nsamples = 0;
+    int index, i, k;
+
+    for (index = 0; index < list_length; index++) {
+        block_t *block = cur_heap->seg_list[index];
+        // the walk is capped, so a cyclic list cannot hold us up
+        for (i = 0; i < per_list && block != NULL; i++) {
+            if ((intptr_t)block <= lo || (intptr_t)block >= hi ||
+                (uintptr_t)block % dsize != wsize) {
+                break;
+            }
+            if (!get_alloc(block) && get_size(block) >= min_block_size &&
+                block->header == *header_to_footer(block)) {
+                samples[nsamples++] = block;
+            }
+            block = list_next(block);
+        }
+    }
+    qsort(samples, (size_t)nsamples, sizeof(samples[0]), compare_blocks);
+
+    job->starts[0] = cur_heap->heap_start;
+    k = 1;
+    for (i = 1; i < nranges && nsamples > 0; i++) {
+        block_t *split = samples[(size_t)i * (size_t)nsamples /
+                                 (size_t)nranges];
+        if (split > job->starts[k - 1]) {
+            job->starts[k++] = split;
+        }
+    }
+    job->starts[k] = NULL;
+    return k;
+}
+
+static void *check_worker(void *arg) {
+    check_job_t *job = arg;
+    int task;
+    while ((task = atomic_fetch_add(&job->next_task, 1)) <
+           job->nranges + list_length) {
+        check_report_t *report = &job->reports[task];
+        check_report_init(report);
+        if (task < job->nranges) {
+            check_heap_range(job->starts[task], job->starts[task + 1],
+                             report);
+        } else {
+            check_free_list(task - job->nranges, report);
+        }
+    }
+    return NULL;
+}
+
+bool mm_checkheap_parallel(int line, int nthreads) {
+    static check_job_t job;
+    pthread_t threads[CHECK_MAX_RANGES];
+    check_report_t merged;
+    int started = 0;
+    int i;
+
+    if (nthreads <= 0) {
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (nthreads > CHECK_MAX_RANGES) {
+        nthreads = CHECK_MAX_RANGES;
+    }
+    if (nthreads <= 1) {
+        return mm_checkheap(line);
+    }
+
+    job.nranges = check_split_heap(&job, nthreads);
+    atomic_store(&job.next_task, 0);
+    for (i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[started], NULL, check_worker, &job) ==
+            0) {
+            started++;
+        }
+    }
+    check_worker(&job);
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    check_report_init(&merged);
+    for (i = 0; i < job.nranges + list_length; i++) {
+        check_report_merge(&merged, &job.reports[i]);
+    }
+    for (i = 1; i < job.nranges; i++) {
+        check_report_t *before = &job.reports[i - 1];
+        check_report_t *after = &job.reports[i];
+        if (before->stop != job.starts[i]) {
+            return mm_checkheap(line); // not a block boundary after all
+        }
+        if (before->last == NULL || after->first == NULL) {
+            continue;
+        }
+        if (get_prev_alloc(after->first) != get_alloc(before->last)) {
+            merged.curr_next = false;
+        }
+        if (!get_alloc(after->first) && !get_alloc(before->last)) {
+            merged.no_consecutive_free = false;
+        }
+    }
+    return check_report_print(&merged);
+}
+
+#else
+
+bool mm_checkheap_parallel(int line, int nthreads) {
+    (void)nthreads;
+    return mm_checkheap(line);
+}
+
+#endif /* MM_PARALLEL_CHECK */
+
+#if defined(DEBUG) || defined(MM_RUNTIME_CHECK)
+/*
+ * Local checking. Operations note the blocks they leave behind with
+ * dbg_touch: the allocated block, a split remainder, a coalesced free
+ * block. Blocks only merge in coalesce_block, before they are noted, so a
+ * noted block is still a block when the operation ends.
+ */
+static PER_THREAD block_t *touched[4];
+static PER_THREAD int num_touched = 0;
+static PER_THREAD unsigned long local_checks = 0;
+
+static void note_touched(block_t *block) {
+    if (num_touched < (int)(sizeof(touched) / sizeof(touched[0]))) {
+        touched[num_touched++] = block;
+    }
+}
+
+/**
+ * @brief Checks one block and the links to its neighbours in the heap and
+ *        in its free list.
+ */
+static bool check_block_local(block_t *block, intptr_t lo, intptr_t hi) {
+    bool ok = true;
+    size_t size = get_size(block);
+    block_t *next;
+    size_t min_size, max_size;
+
+    if ((intptr_t)block <= lo || (intptr_t)block >= hi ||
+        size % dsize != 0 || size < min_block_size) {
+        printf("block address out of range\n");
+        return false; // too broken to look at its neighbours
+    }
+    if (get_alloc(block) && (intptr_t)header_to_payload(block) % 16 != 0) {
+        printf("payload not aligned\n");
+        ok = false;
+    }
+
+    next = find_next(block);
+    if ((intptr_t)next <= lo || (intptr_t)next > hi ||
+        (get_size(next) > 0 &&
+         (get_size(next) % dsize != 0 || get_size(next) < min_block_size ||
+          (intptr_t)find_next(next) > hi))) {
+        printf("block address out of range\n");
+        return false;
+    }
+    if (get_size(next) > 0 && get_prev_alloc(next) != get_alloc(block)) {
+        printf("the alloc info of some block is inconsistent with the prev "
+               "alloc info of its following block\n");
+        ok = false;
+    }
+    if (!get_alloc(block) &&
+        ((get_size(next) > 0 && !get_alloc(next)) || !get_prev_alloc(block))) {
+        printf("exist consecutive free blocks\n");
+        ok = false;
+    }
+    if (block != cur_heap->heap_start && !get_prev_alloc(block)) {
+        block_t *prev = find_prev(block);
+        if ((intptr_t)prev <= lo || find_next(prev) != block ||
+            get_alloc(prev)) {
+            printf("for some free blocks, the header and footer are "
+                   "inconsistent\n");
+            ok = false;
+        }
+    }
+    if (get_alloc(block)) {
+        return ok;
+    }
+
+    if (block->header != *header_to_footer(block)) {
+        printf(
+            "for some free blocks, the header and footer are inconsistent\n");
+        ok = false;
+    }
+    list_bounds(find_index(size), &min_size, &max_size);
+    if (size < min_size || size >= max_size) {
+        printf("block size is out of the size range of the block list it "
+               "belongs to\n");
+        ok = false;
+    }
+    if ((list_prev(block) == NULL &&
+         cur_heap->seg_list[find_index(size)] != block) ||
+        (list_prev(block) != NULL && list_next(list_prev(block)) != block) ||
+        (list_next(block) != NULL && list_prev(list_next(block)) != block)) {
+        printf("block->next->prev != block\n");
+        ok = false;
+    }
+    return ok;
+}
+
+/**
+ * @brief Checks the invariants near the blocks the last operation touched,
+ *        the heads of the free lists and the prologue and epilogue; every
+ *        MM_CHECK_INTERVAL-th call runs the full mm_checkheap instead.
+ *
+ * Used by the dbg_ contracts after each operation, so that DEBUG builds
+ * stay close to release speed while still catching corruption near where
+ * it happens.
+ *
+ * @param[in] line The caller's line number
+ * @return true if every checked invariant holds
+ */
+static bool checkheap_local(int line) {
+    intptr_t lo = (intptr_t)heap_lo();
+    intptr_t hi = (intptr_t)heap_hi() - 7;
+    bool ok = true;
+    int i;
+
+    if (++local_checks % MM_CHECK_INTERVAL == 0) {
+        num_touched = 0;
+        return mm_checkheap(line);
+    }
+
+    for (i = 0; i < num_touched; i++) {
+        if (!check_block_local(touched[i], lo, hi)) {
+            ok = false;
+        }
+    }
+    num_touched = 0;
+
+    for (i = 0; i < list_length; i++) {
+        block_t *head = cur_heap->seg_list[i];
+        if (head == NULL) {
+            continue;
+        }
+        if ((intptr_t)head <= lo || (intptr_t)head >= hi) {
+            printf("block address out of range\n");
+            ok = false;
+        } else if (list_prev(head) != NULL || get_alloc(head)) {
+            printf("block->next->prev != block\n");
+            ok = false;
+        }
+    }
+
+    if (!check_epi_prologue()) {
+        printf("bad epilogue or prologue blocks\n");
+        ok = false;
+    }
+    return ok;
+}
+#endif /* DEBUG || MM_RUNTIME_CHECK */
+
+/*
+ * The runtime checking level. The MM_CHECK environment variable is read
+ * once, at the first check point, unless mm_check_set_level was called
+ * first. The sampling state is per thread, like the touched blocks, so
+ * that calls on private heaps in different threads can check at once.
+ */
+static struct {
+    mm_check_level_t level;
+    unsigned long period; // sampled: every period-th operation, or 0
+    double probability;   // sampled with a period of 0
+    bool configured;
+} check_config = {
+#ifdef DEBUG
+    MM_CHECK_LOCAL,
+#else
+    MM_CHECK_OFF,
+#endif
+    0, 0, false};
+
+bool mm_check_set_level(mm_check_level_t level, unsigned long period,
+                        double probability) {
+#if defined(DEBUG) || defined(MM_RUNTIME_CHECK)
+    if (level < MM_CHECK_OFF || level > MM_CHECK_FULL ||
+        (level == MM_CHECK_SAMPLED && period == 0 &&
+         (probability <= 0 || probability > 1))) {
+        return false;
+    }
+    check_config.level = level;
+    check_config.period = period;
+    check_config.probability = probability;
+    check_config.configured = true;
+    return true;
+#else
+    (void)level;
+    (void)period;
+    (void)probability;
+    return false;
+#endif
+}
+
+mm_check_level_t mm_check_get_level(void) {
+    return check_config.level;
+}
+
+#if defined(DEBUG) || defined(MM_RUNTIME_CHECK)
+static PER_THREAD unsigned long check_count; // check points seen
+static PER_THREAD uint64_t check_random = 0x9e3779b97f4a7c15u; // xorshift
+static pthread_once_t check_env_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Sets the level from MM_CHECK, if it is set and well formed and
+ *        mm_check_set_level has not been called.
+ */
+static void check_read_env(void) {
+    const char *value = getenv("MM_CHECK");
+    if (check_config.configured) {
+        return;
+    }
+    check_config.configured = true;
+    if (value == NULL) {
+        return;
+    }
+    if (strcmp(value, "off") == 0) {
+        mm_check_set_level(MM_CHECK_OFF, 0, 0);
+    } else if (strcmp(value, "local") == 0) {
+        mm_check_set_level(MM_CHECK_LOCAL, 0, 0);
+    } else if (strcmp(value, "full") == 0) {
+        mm_check_set_level(MM_CHECK_FULL, 0, 0);
+    } else if (strncmp(value, "sampled:", 8) == 0) {
+        char *end;
+        double n = strtod(value + 8, &end);
+        if (end == value + 8 || *end != '\0') {
+            return;
+        }
+        // Below 1 it is a probability (0.001, 1e-3), else a whole period
+        if (n < 1) {
+            mm_check_set_level(MM_CHECK_SAMPLED, 0, n);
+        } else if (n == (double)(unsigned long)n) {
+            mm_check_set_level(MM_CHECK_SAMPLED, (unsigned long)n, 0);
+        }
+    }
+}
+
+/**
+ * @brief Decides whether this operation is sampled.
+ */
+static bool check_sampled(void) {
+    uint64_t x;
+    if (check_config.period > 0) {
+        return check_count % check_config.period == 0;
+    }
+    x = check_random;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    check_random = x;
+    return (double)(x >> 11) * 0x1.0p-53 < check_config.probability;
+}
+
+/**
+ * @brief Runs the checks the current level asks for at the end of an
+ *        operation, and forgets the blocks it touched.
+ * @param[in] line The caller's line number
+ * @return false if a check failed
+ */
+static bool check_point(int line) {
+    bool ok = true;
+    pthread_once(&check_env_once, check_read_env);
+    check_count++;
+    switch (check_config.level) {
+    case MM_CHECK_LOCAL:
+        return checkheap_local(line);
+    case MM_CHECK_FULL:
+        ok = mm_checkheap(line);
+        break;
+    case MM_CHECK_SAMPLED:
+        if (check_sampled()) {
+            ok = mm_checkheap(line);
+        }
+        break;
+    default:
+        break;
+    }
+    num_touched = 0;
+    return ok;
+}
+
+#if !defined(DEBUG) && defined(MM_RUNTIME_CHECK)
+/**
+ * @brief Reports a failed check in a release build and aborts.
+ */
+static bool check_failed(int line) {
+    fflush(stdout); // the diagnostics of mm_checkheap
+    fprintf(stderr, "mm: heap check failed after line %d\n", line);
+    abort();
+    return false;
+}
+#endif /* !DEBUG && MM_RUNTIME_CHECK */
+#endif /* DEBUG || MM_RUNTIME_CHECK */
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        END DEBUG HELPER FUNCTIONS
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief
+ *
+ * <What does this function do?>
+ * <What are the function's arguments?>
+ * <What is the function's return value?>
+ * <Are there any preconditions or postconditions?>
+ *
+ * @return
+ */
+bool mm_init(void) {
+    // Create the initial empty heap
+    word_t *start = (word_t *)(heap_sbrk(2 * wsize));
+
+    if (start == (void *)-1) {
+        return false;
+    }
+
+    start[0] = pack(0, true, true); // Heap prologue (block footer)
+    start[1] = pack(0, true, true); // Heap epilogue (block header)
+
+    // Heap starts with first "block header", currently the epilogue
+    cur_heap->heap_start = (block_t *)&(start[1]);
+    cur_heap->heap_base = heap_lo();
+
+    int index;
+    for (index = 0; index < list_length; index++) {
+        cur_heap->seg_list[index] = NULL;
+    }
+
+    // Extend the empty heap with a free block of chunksize bytes
+    if (extend_heap(chunksize) == NULL) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Allocates a block of `asize` bytes, already adjusted, from size
+ *        class `index`.
+ *
+ * The part of heap_malloc after the request has been classified, for
+ * callers that classified it beforehand.
+ *
+ * @param[in] asize round_up(size + wsize, dsize) of the request
+ * @param[in] index find_index(asize)
+ * @return The payload pointer, or NULL
+ */
+static void *heap_malloc_class(size_t asize, int index) {
+    size_t extendsize; // Amount to extend heap if no fit is found
+    block_t *block;
+    void *bp = NULL;
+
+    dbg_requires(asize >= min_block_size && asize % dsize == 0);
+    dbg_requires(index == find_index(asize));
+
+    // Search the free list for a fit
+    block = find_fit(asize, index);
+
+    // If no fit is found, request more memory, and then and place the block
+    if (block == NULL) {
+        // Always request at least chunksize
+        extendsize = max(asize, chunksize);
+        block = extend_heap(extendsize);
+        // extend_heap returns an error
+        if (block == NULL) {
+            errno = ENOMEM;
+            return bp;
+        }
+    }
+
+    // The block should be marked as free
+    dbg_assert(!get_alloc(block));
+
+    // Try to split the block if too large
+    split_block(block, asize);
+
+    bp = header_to_payload(block);
+
+    dbg_checkheap(__LINE__);
+    // printf("printing heap in malloc... \n");
+    // print_heap();
+    return bp;
+}
+
+/**
+ * @brief
+ *
+ * <What does this function do?>
+ * <What are the function's arguments?>
+ * <What is the function's return value?>
+ * <Are there any preconditions or postconditions?>
+ *
+ * @param[in] size
+ * @return
+ */
+static void *heap_malloc(size_t size) {
+    size_t asize; // Adjusted block size
+
+    // Initialize heap if it isn't initialized
+    if (cur_heap->heap_start == NULL) {
+        mm_init();
+    }
+
+    // Ignore spurious request; the C library's allocator gives a unique
+    // block instead, and programs run under the preload library rely on it
+    if (size == 0) {
+#ifdef MM_PRELOAD
+        size = 1;
+#else
+        dbg_checkheap(__LINE__);
+        return NULL;
+#endif
+    }
+
+    // A request this close to SIZE_MAX would wrap around to a tiny block
+    if (size > (size_t)-1 - wsize - dsize) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Adjust block size to include overhead and to meet alignment requirements
+    asize = round_up(size + wsize, dsize);
+    return heap_malloc_class(asize, find_index(asize));
+}
+
+/**
+ * @brief Allocates a block with at least `size` bytes of payload.
+ *
+ * A timed wrapper around heap_malloc.
+ *
+ * @param[in] size
+ * @return A 16-byte aligned payload pointer, or NULL
+ */
+void *malloc(size_t size) {
+    uint64_t start = latency_begin();
+    void *bp;
+    heap_lock();
+    bp = heap_malloc(size);
+    latency_end(MM_OP_MALLOC, request_class(size), start);
+    trace_record(MM_OP_MALLOC, size, 0, NULL, bp);
+    heap_unlock();
+    return bp;
+}
+
+/**
+ * @brief Allocates a block of `asize` bytes from size class `size_class`,
+ *        both worked out by the caller.
+ *
+ * For callers that know the request size at compile time (mm_allocator.hpp)
+ * and so can skip round_up and find_index. `asize` is the request plus one
+ * word, rounded up to dsize and at least min_block_size; `size_class` is
+ * the class whose bin MM_CLASS_MIN_SIZES puts it in. Traced as a malloc of
+ * asize - wsize bytes.
+ *
+ * @param[in] asize
+ * @param[in] size_class
+ * @return A 16-byte aligned payload pointer, or NULL
+ */
+void *mm_malloc_class(size_t asize, int size_class) {
+    uint64_t start = latency_begin();
+    void *bp = NULL;
+    heap_lock();
+    if (cur_heap->heap_start != NULL || mm_init()) {
+        bp = heap_malloc_class(asize, size_class);
+    }
+    latency_end(MM_OP_MALLOC, size_class, start);
+    trace_record(MM_OP_MALLOC, asize - wsize, 0, NULL, bp);
+    heap_unlock();
+    return bp;
+}
+
+/**
+ * @brief
+ *
+ * <What does this function do?>
+ * <What are the function's arguments?>
+ * <What is the function's return value?>
+ * <Are there any preconditions or postconditions?>
+ *
+ * @param[in] bp
+ */
+static void heap_free(void *bp) {
+    if (bp == NULL) {
+        return;
+    }
+
+    block_t *block = payload_to_header(bp);
+    size_t size = get_size(block);
+
+    // The block should be marked as allocated
+    dbg_assert(get_alloc(block));
+
+    // Mark the block as free
+    // printf("start writing \n");
+    write_block(block, size, false, get_prev_alloc(block));
+    // printf("writing successful\n");
+    update_next_prev_alloc(block, false);
+    // printf("update_next_prev_alloc successful\n");
+
+    // Try to coalesce the block with its neighbors
+    block = coalesce_block(block);
+    add_to_list(block);
+    // printf("printing linkedList in free\n...");
+    // print_linkedList();
+    // printf("coalesce successful\n");
+    dbg_checkheap(__LINE__);
+}
+
+/**
+ * @brief Frees a block returned by malloc, calloc or realloc.
+ *
+ * A timed wrapper around heap_free. The size class is read from the
+ * header before the block is freed and possibly coalesced. The free is
+ * traced before it happens, so that a concurrent malloc of the same block
+ * cannot be stamped earlier.
+ *
+ * @param[in] bp
+ */
+void free(void *bp) {
+    uint64_t start = latency_begin();
+    int size_class = 0;
+    heap_lock();
+    // The header word also holds the prev_alloc bit, which other threads
+    // rewrite under the lock when they free or allocate a neighbour
+    if (bp != NULL) {
+        size_class = find_index(get_size(payload_to_header(bp)));
+    }
+    trace_record(MM_OP_FREE, 0, 0, bp, NULL);
+    heap_free(bp);
+    latency_end(MM_OP_FREE, size_class, start);
+    heap_unlock();
+}
+
+/**
+ * @brief
+ *
+ * <What does this function do?>
+ * <What are the function's arguments?>
+ * <What is the function's return value?>
+ * <Are there any preconditions or postconditions?>
+ *
+ * @param[in] ptr
+ * @param[in] size
+ * @return
+ */
+static void *heap_realloc(void *ptr, size_t size) {
+    block_t *block = payload_to_header(ptr);
+    size_t copysize;
+    void *newptr;
+
+    // If ptr is NULL, then equivalent to malloc, even for size == 0
+    if (ptr == NULL) {
+        return heap_malloc(size);
+    }
+
+    // If size == 0, then free block and return NULL
+    if (size == 0) {
+        heap_free(ptr);
+        return NULL;
+    }
+
+    // Otherwise, proceed with reallocation
+    newptr = heap_malloc(size);
+
+    // If malloc fails, the original block is left untouched
+    if (newptr == NULL) {
+        return NULL;
+    }
+
+    // Copy the old data
+    copysize = get_payload_size(block); // gets size of old payload
+    if (size < copysize) {
+        copysize = size;
+    }
+    memcpy(newptr, ptr, copysize);
+
+    // Free the old block
+    heap_free(ptr);
+
+    return newptr;
+}
+
+/**
+ * @brief Resizes the block at `ptr` to hold at least `size` bytes.
+ *
+ * A timed wrapper around heap_realloc.
+ *
+ * @param[in] ptr
+ * @param[in] size
+ * @return The new payload pointer, or NULL
+ */
+void *realloc(void *ptr, size_t size) {
+    uint64_t start = latency_begin();
+    void *newptr;
+    heap_lock();
+    newptr = heap_realloc(ptr, size);
+    latency_end(MM_OP_REALLOC, request_class(size), start);
+    trace_record(MM_OP_REALLOC, size, 0, ptr, newptr);
+    heap_unlock();
+    return newptr;
+}
+
+/**
+ * @brief
+ *
+ * <What does this function do?>
+ * <What are the function's arguments?>
+ * <What is the function's return value?>
+ * <Are there any preconditions or postconditions?>
+ *
+ * @param[in] elements
+ * @param[in] size
+ * @return
+ */
+static void *heap_calloc(size_t elements, size_t size) {
+    void *bp;
+    size_t asize = elements * size;
+
+    if (elements != 0 && asize / elements != size) {
+        // Multiplication overflowed
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // A zero-byte array is a zero-byte malloc
+    bp = heap_malloc(asize);
+    if (bp == NULL) {
+        return NULL;
+    }
+
+    // Initialize all bits to 0
+    memset(bp, 0, asize);
+
+    return bp;
+}
+
+/**
+ * @brief Allocates a zeroed array of `elements` elements of `size` bytes.
+ *
+ * A timed wrapper around heap_calloc. Overflowing requests are counted in
+ * the largest size class.
+ *
+ * @param[in] elements
+ * @param[in] size
+ * @return The payload pointer, or NULL
+ */
+void *calloc(size_t elements, size_t size) {
+    uint64_t start = latency_begin();
+    int size_class = (elements != 0 && (elements * size) / elements != size)
+                         ? MM_NUM_CLASSES - 1
+                         : request_class(elements * size);
+    void *bp;
+    heap_lock();
+    bp = heap_calloc(elements, size);
+    latency_end(MM_OP_CALLOC, size_class, start);
+    trace_record(MM_OP_CALLOC, size, elements, NULL, bp);
+    heap_unlock();
+    return bp;
+}
+
+/**
+ * @brief Allocates a block whose payload is aligned to `align`.
+ *
+ * Alignments up to dsize are what heap_malloc gives anyway. Above that,
+ * heap_malloc is asked for enough room to find an aligned payload at
+ * least min_block_size bytes in; the bytes before it become a free block
+ * of their own, and the bytes after it are split off and freed if they
+ * make a block.
+ *
+ * @param[in] align A power of two
+ * @param[in] size
+ * @return The aligned payload pointer, or NULL
+ */
+static void *heap_aligned_alloc(size_t align, size_t size) {
+    size_t asize;
+    size_t total;
+    block_t *block;
+    block_t *aligned;
+    char *bp;
+    char *ap;
+
+    if (align <= dsize) {
+        return heap_malloc(size);
+    }
+    if (size == 0) {
+#ifdef MM_PRELOAD
+        size = 1; // a unique block, as heap_malloc gives
+#else
+        return NULL;
+#endif
+    }
+    if (size > (size_t)-1 - 2 * align - 2 * min_block_size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    asize = round_up(size + wsize, dsize);
+    bp = heap_malloc(asize + align + min_block_size);
+    if (bp == NULL) {
+        return NULL;
+    }
+    block = payload_to_header(bp);
+    total = get_size(block);
+
+    // Free the bytes before the aligned payload; align >= min_block_size
+    ap = (char *)(((uintptr_t)bp + align - 1) & ~(uintptr_t)(align - 1));
+    if (ap != bp && (size_t)(ap - bp) < min_block_size) {
+        ap += align;
+    }
+    aligned = payload_to_header(ap);
+    if (aligned != block) {
+        size_t gap = (size_t)(ap - bp);
+        write_block(aligned, total - gap, true, false);
+        write_block(block, gap, false, get_prev_alloc(block));
+        add_to_list(block);
+        total -= gap;
+    }
+
+    // Free the bytes after it
+    if (total - asize >= min_block_size) {
+        block_t *rest;
+        write_block(aligned, asize, true, get_prev_alloc(aligned));
+        rest = find_next(aligned);
+        write_block(rest, total - asize, false, true);
+        update_next_prev_alloc(rest, false);
+        rest = coalesce_block(rest);
+        add_to_list(rest);
+    }
+
+    dbg_touch(aligned);
+    dbg_checkheap(__LINE__);
+    return ap;
+}
+
+/**
+ * @brief Allocates `size` bytes aligned to `align`, a power of two.
+ *
+ * A timed wrapper around heap_aligned_alloc, traced as a malloc.
+ *
+ * @param[in] align
+ * @param[in] size
+ * @return The payload pointer, or NULL (also for an invalid alignment)
+ */
+void *mm_aligned_alloc(size_t align, size_t size) {
+    uint64_t start = latency_begin();
+    void *bp = NULL;
+    heap_lock();
+    if (align != 0 && (align & (align - 1)) == 0) {
+        bp = heap_aligned_alloc(align, size);
+    }
+    latency_end(MM_OP_MALLOC, request_class(size), start);
+    trace_record(MM_OP_MALLOC, size, 0, NULL, bp);
+    heap_unlock();
+    return bp;
+}
+
+/**
+ * @brief Frees a block whose requested size the caller knows.
+ *
+ * Like free, except that the size class for the latency histograms comes
+ * from `size` rather than from the header, which is then only read by
+ * heap_free itself.
+ *
+ * @param[in] bp
+ * @param[in] size The size the block was requested with
+ */
+void mm_free_sized(void *bp, size_t size) {
+    uint64_t start = latency_begin();
+    dbg_requires(bp == NULL || size <= mm_usable_size(bp));
+    heap_lock();
+    trace_record(MM_OP_FREE, 0, 0, bp, NULL);
+    heap_free(bp);
+    latency_end(MM_OP_FREE, request_class(size), start);
+    heap_unlock();
+}
+
+/**
+ * @brief Returns the number of payload bytes usable at `bp`.
+ * @param[in] bp A pointer returned by malloc, calloc or realloc, or NULL
+ * @return The block size minus its header, or 0 for NULL
+ */
+size_t mm_usable_size(void *bp) {
+    if (bp == NULL) {
+        return 0;
+    }
+    return get_payload_size(payload_to_header(bp));
+}
+
+/**
+ * @brief Walks the current heap and summarizes its blocks into `stats`.
+ * @param[out] stats
+ */
+void mm_heap_stats(mm_heap_stats_t *stats) {
+    block_t *block;
+    memset(stats, 0, sizeof(*stats));
+    if (cur_heap->heap_start == NULL) {
+        return;
+    }
+    stats->heap_size = (size_t)(heap_hi() - heap_lo()) + 1;
+    for (block = cur_heap->heap_start; get_size(block) > 0;
+         block = find_next(block)) {
+        size_t size = get_size(block);
+        if (get_alloc(block)) {
+            stats->alloc_blocks++;
+            stats->alloc_bytes += size;
+        } else {
+            stats->free_blocks++;
+            stats->free_bytes += size;
+            stats->largest_free = max(stats->largest_free, size);
+        }
+    }
+}
+
+/** @brief Bytes mm_snapshot encodes before each write */
+#define SNAPSHOT_BUF_SIZE (16 * 1024)
+
+/**
+ * @brief Writes all of `len` bytes to `fd`.
+ */
+static bool write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * @brief Writes a description of every block and of the seg_list heads to
+ *        `fd`, in the format of mm_snapshot.h.
+ *
+ * One varint per block, encoded into a stack buffer and written out in
+ * SNAPSHOT_BUF_SIZE pieces, so that a snapshot of a large heap costs
+ * about one pass over the headers.
+ *
+ * @param[in] fd An open file descriptor
+ * @return false if the heap is not initialized or a write failed
+ */
+bool mm_snapshot(int fd) {
+    unsigned char buf[SNAPSHOT_BUF_SIZE];
+    unsigned char *p = buf;
+    char *lo = mem_heap_lo();
+    block_t *block;
+    int index;
+
+    if (cur_heap->heap_start == NULL) {
+        return false;
+    }
+    memcpy(p, MM_SNAPSHOT_MAGIC, 4);
+    p += 4;
+    *p++ = MM_SNAPSHOT_VERSION;
+    p = put_varint(p, mem_heapsize());
+    p = put_varint(p, (uint64_t)((char *)cur_heap->heap_start - lo));
+    p = put_varint(p, (uint64_t)list_length);
+    for (index = 0; index < list_length; index++) {
+        size_t min_size, max_size;
+        list_bounds(index, &min_size, &max_size);
+        p = put_varint(p, min_size);
+    }
+    for (index = 0; index < list_length; index++) {
+        block = cur_heap->seg_list[index];
+        p = put_varint(p, (block == NULL)
+                              ? 0
+                              : (uint64_t)((char *)block - lo) + 1);
+    }
+
+    for (block = cur_heap->heap_start; get_size(block) > 0;
+         block = find_next(block)) {
+        if (p - buf > SNAPSHOT_BUF_SIZE - 16) {
+            if (!write_all(fd, buf, (size_t)(p - buf))) {
+                return false;
+            }
+            p = buf;
+        }
+        p = put_varint(p, (get_size(block) / dsize) << 2 |
+                              (uint64_t)get_prev_alloc(block) << 1 |
+                              (uint64_t)get_alloc(block));
+    }
+    *p++ = 0; // the epilogue
+    return write_all(fd, buf, (size_t)(p - buf));
+}
+
+/**
+ * @brief Fills in the allocator state that a checkpoint keeps outside the
+ *        heap image.
+ */
+static void checkpoint_meta(mm_checkpoint_meta_t *meta) {
+    int index;
+    memset(meta, 0, sizeof(*meta));
+    meta->heap_size = mem_heapsize();
+    meta->heap_start = block_to_link(cur_heap->heap_start);
+    meta->nbins = (uint64_t)list_length;
+    for (index = 0; index < list_length; index++) {
+        meta->seg_list[index] = block_to_link(cur_heap->seg_list[index]);
+    }
+}
+
+/**
+ * @brief Saves the whole heap to `path`, in the format of mm_checkpoint.h.
+ *
+ * The checkpoint is written to `path`.tmp and renamed over `path` once
+ * complete, so a crash during a checkpoint leaves the previous one intact.
+ *
+ * @param[in] path
+ * @return false if the heap is not initialized or the file cannot be
+ *         written
+ */
+bool mm_checkpoint(const char *path) {
+    mm_checkpoint_header_t header;
+    char tmp_path[4096];
+    char *lo = mem_heap_lo();
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    int fd;
+    bool ok;
+
+    if (cur_heap->heap_start == NULL ||
+        (size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+            sizeof(tmp_path)) {
+        return false;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MM_CHECKPOINT_MAGIC, 4);
+    header.version = MM_CHECKPOINT_VERSION;
+    header.image_offset = (sizeof(header) + page - 1) / page * page;
+    checkpoint_meta(&header.meta);
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    ok = write_all(fd, (const unsigned char *)&header, sizeof(header)) &&
+         lseek(fd, (off_t)header.image_offset, SEEK_SET) ==
+             (off_t)header.image_offset &&
+         write_all(fd, (const unsigned char *)lo, header.meta.heap_size) &&
+         fsync(fd) == 0;
+    if (close(fd) != 0 || !ok || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Checks that `offset` can be the header of a block of at least
+ *        `size` bytes in an image of `heap_size` bytes: its payload is
+ *        16-byte aligned and the block ends before the epilogue.
+ */
+static bool checkpoint_block_valid(uint64_t offset, uint64_t size,
+                                   uint64_t heap_size) {
+    return offset % dsize == wsize && offset <= heap_size - wsize &&
+           size <= heap_size - wsize - offset;
+}
+
+/**
+ * @brief Reads the header of a checkpoint and checks that it describes a
+ *        heap this allocator can use, with heap_start and the seg_list
+ *        heads at block boundaries inside the image.
+ */
+static bool read_checkpoint_header(int fd, mm_checkpoint_header_t *header) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    mm_checkpoint_meta_t *meta = &header->meta;
+    struct stat st;
+    int index;
+    if (pread(fd, header, sizeof(*header), 0) != (ssize_t)sizeof(*header) ||
+        fstat(fd, &st) != 0) {
+        return false;
+    }
+    if (memcmp(header->magic, MM_CHECKPOINT_MAGIC, 4) != 0 ||
+        header->version != MM_CHECKPOINT_VERSION ||
+        meta->nbins != (uint64_t)list_length ||
+        header->image_offset % page != 0 ||
+        header->image_offset < sizeof(*header) ||
+        meta->heap_size < 2 * wsize || meta->heap_size % dsize != 0 ||
+        header->image_offset > (uint64_t)st.st_size ||
+        meta->heap_size > (uint64_t)st.st_size - header->image_offset) {
+        return false;
+    }
+    // heap_start may be the epilogue, in a heap with no blocks
+    if (!checkpoint_block_valid(meta->heap_start, 0, meta->heap_size)) {
+        return false;
+    }
+    for (index = 0; index < list_length; index++) {
+        if (meta->seg_list[index] != 0 &&
+            !checkpoint_block_valid(meta->seg_list[index], min_block_size,
+                                    meta->heap_size)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN DIRTY PAGE TRACKING
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * Between mm_checkpoint_begin and mm_checkpoint_end, every heap page
+ * written since the last checkpoint is noted in track.dirty, one byte per
+ * page from track.first. Where the kernel keeps soft-dirty bits, they are
+ * cleared through /proc/self/clear_refs at each checkpoint and read back
+ * from /proc/self/pagemap. Otherwise the pages are write-protected, and
+ * track_fault notes the first write to each page and unprotects it.
+ *
+ * Pages past the end of the heap at the last checkpoint are not tracked;
+ * all of them count as dirty.
+ */
+static struct {
+    bool on;
+    bool soft_dirty;               // else write protection
+    size_t page;                   // the page size
+    char *first;                   // first tracked page
+    size_t npages;                 // tracked pages
+    size_t map_size;               // bytes mmap'ed for dirty
+    volatile unsigned char *dirty; // one byte per tracked page
+    struct sigaction old_action;   // the SIGSEGV action before track_fault
+} track;
+
+/** @brief Bit of a /proc/self/pagemap entry set for soft-dirty pages */
+#define PAGEMAP_SOFT_DIRTY ((uint64_t)1 << 55)
+
+/** @brief Bytes mm_checkpoint_delta and mm_checkpoint_compact buffer */
+#define CHECKPOINT_BUF_SIZE (16 * 1024)
+
+/**
+ * @brief SIGSEGV handler: a write to a write-protected tracked page marks
+ *        it dirty and unprotects it; any other fault goes to the handler
+ *        that was installed before.
+ */
+static void track_fault(int sig, siginfo_t *info, void *context) {
+    char *addr = info->si_addr;
+    if (track.on && !track.soft_dirty && addr >= track.first &&
+        addr < track.first + track.npages * track.page) {
+        size_t index = (size_t)(addr - track.first) / track.page;
+        track.dirty[index] = 1;
+        mprotect(track.first + index * track.page, track.page,
+                 PROT_READ | PROT_WRITE);
+        return;
+    }
+    if (track.old_action.sa_flags & SA_SIGINFO) {
+        track.old_action.sa_sigaction(sig, info, context);
+    } else if (track.old_action.sa_handler != SIG_DFL &&
+               track.old_action.sa_handler != SIG_IGN) {
+        track.old_action.sa_handler(sig);
+    } else {
+        signal(sig, SIG_DFL); // the fault recurs and takes the default
+    }
+}
+
+/**
+ * @brief Clears the soft-dirty bit of every page of the process.
+ */
+static bool track_clear_soft_dirty(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    bool ok;
+    if (fd < 0) {
+        return false;
+    }
+    ok = (write(fd, "4", 1) == 1);
+    close(fd);
+    return ok;
+}
+
+/**
+ * @brief Copies the soft-dirty bits of `npages` pages from `first` into
+ *        `dirty`.
+ */
+static bool track_read_soft_dirty(char *first, size_t npages,
+                                  volatile unsigned char *dirty) {
+    uint64_t entries[512];
+    size_t done = 0;
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    while (done < npages) {
+        size_t count = npages - done;
+        size_t i;
+        off_t at = (off_t)(((uintptr_t)first / track.page + done) *
+                           sizeof(entries[0]));
+        if (count > sizeof(entries) / sizeof(entries[0])) {
+            count = sizeof(entries) / sizeof(entries[0]);
+        }
+        if (pread(fd, entries, count * sizeof(entries[0]), at) !=
+            (ssize_t)(count * sizeof(entries[0]))) {
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            dirty[done + i] = (entries[i] & PAGEMAP_SOFT_DIRTY) != 0;
+        }
+        done += count;
+    }
+    close(fd);
+    return done == npages;
+}
+
+/**
+ * @brief Tells whether the kernel keeps soft-dirty bits, by clearing them
+ *        and writing to the first page of track.dirty.
+ */
+static bool track_probe_soft_dirty(void) {
+    unsigned char probe = 0;
+    track.dirty[0] = 0;
+    if (!track_clear_soft_dirty()) {
+        return false;
+    }
+    track.dirty[0] = 1;
+    return track_read_soft_dirty((char *)track.dirty, 1, &probe) &&
+           probe != 0;
+}
+
+/**
+ * @brief Grows track.dirty to cover the current heap, if needed, and
+ *        clears it.
+ */
+static bool track_resize(void) {
+    char *lo = mem_heap_lo();
+    char *first = (char *)((uintptr_t)lo / track.page * track.page);
+    size_t npages = ((size_t)(lo - first) + mem_heapsize() + track.page - 1) /
+                    track.page;
+    if (npages > track.map_size) {
+        size_t map_size = (npages + track.page - 1) / track.page * track.page;
+        void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        if (track.dirty != NULL) {
+            munmap((void *)track.dirty, track.map_size);
+        }
+        track.dirty = map;
+        track.map_size = map_size;
+    } else {
+        memset((void *)track.dirty, 0, npages);
+    }
+    track.first = first;
+    track.npages = npages;
+    return true;
+}
+
+/**
+ * @brief Starts a new tracking period over the current heap: every page
+ *        is clean from here on.
+ */
+static bool track_arm(void) {
+    if (!track_resize()) {
+        return false;
+    }
+    if (track.soft_dirty) {
+        return track_clear_soft_dirty();
+    }
+    return mprotect(track.first, track.npages * track.page, PROT_READ) == 0;
+}
+
+/**
+ * @brief Tells whether page `index` from track.first was written since
+ *        the last checkpoint.
+ */
+static bool track_is_dirty(size_t index) {
+    return index >= track.npages || track.dirty[index] != 0;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        END DIRTY PAGE TRACKING
+ * ---------------------------------------------------------------------------
+ */
+
+/**
+ * @brief Saves the whole heap to `base_path` and starts tracking the pages
+ *        written after it, for mm_checkpoint_delta.
+ *
+ * Soft-dirty bits are used where the kernel has them; otherwise the heap
+ * is write-protected and a SIGSEGV handler notes the first write to each
+ * page, chaining to the previous handler for unrelated faults.
+ *
+ * @param[in] base_path
+ * @return false if the checkpoint could not be written or tracking could
+ *         not be started
+ */
+bool mm_checkpoint_begin(const char *base_path) {
+    struct sigaction action;
+    if (!mm_checkpoint(base_path)) {
+        return false;
+    }
+    if (track.on) {
+        return track_arm();
+    }
+    track.page = (size_t)sysconf(_SC_PAGESIZE);
+    if (!track_resize()) {
+        return false;
+    }
+    track.soft_dirty = track_probe_soft_dirty();
+    if (!track.soft_dirty) {
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = track_fault;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGSEGV, &action, &track.old_action) != 0) {
+            return false;
+        }
+    }
+    track.on = true;
+    if (!track_arm()) {
+        mm_checkpoint_end();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Appends the heap pages written since the last checkpoint, and the
+ *        allocator metadata, to `delta_path` as one record.
+ *
+ * Runs of dirty pages are written as single ranges, clipped to the heap.
+ * The record is counted first so that its size can lead it; if a write
+ * fails, the file is cut back to where the record started and the pages
+ * stay dirty for the next call.
+ *
+ * @param[in] delta_path The delta file, created if needed
+ * @return false if tracking is off or the record could not be written
+ */
+bool mm_checkpoint_delta(const char *delta_path) {
+    mm_checkpoint_record_t record;
+    mm_checkpoint_range_t range;
+    char *lo = mem_heap_lo();
+    char *end = lo + mem_heapsize();
+    size_t npages;
+    size_t index;
+    struct stat st;
+    int fd;
+    bool ok = true;
+
+    if (!track.on) {
+        return false;
+    }
+    if (track.soft_dirty &&
+        !track_read_soft_dirty(track.first, track.npages, track.dirty)) {
+        return false;
+    }
+    npages = ((size_t)(end - track.first) + track.page - 1) / track.page;
+
+    memset(&record, 0, sizeof(record));
+    memcpy(record.magic, MM_CHECKPOINT_DELTA_MAGIC, 4);
+    record.version = MM_CHECKPOINT_VERSION;
+    record.record_size = sizeof(record);
+    checkpoint_meta(&record.meta);
+    for (index = 0; index < npages;) {
+        char *from;
+        char *to;
+        if (!track_is_dirty(index)) {
+            index++;
+            continue;
+        }
+        from = track.first + index * track.page;
+        while (index < npages && track_is_dirty(index)) {
+            index++;
+        }
+        to = track.first + index * track.page;
+        from = (from < lo) ? lo : from;
+        to = (to > end) ? end : to;
+        record.nranges++;
+        record.record_size += sizeof(range) + (uint64_t)(to - from);
+    }
+
+    fd = open(delta_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    ok = write_all(fd, (const unsigned char *)&record, sizeof(record));
+    for (index = 0; ok && index < npages;) {
+        char *from;
+        char *to;
+        if (!track_is_dirty(index)) {
+            index++;
+            continue;
+        }
+        from = track.first + index * track.page;
+        while (index < npages && track_is_dirty(index)) {
+            index++;
+        }
+        to = track.first + index * track.page;
+        from = (from < lo) ? lo : from;
+        to = (to > end) ? end : to;
+        range.offset = (uint64_t)(from - lo);
+        range.length = (uint64_t)(to - from);
+        ok = write_all(fd, (const unsigned char *)&range, sizeof(range)) &&
+             write_all(fd, (const unsigned char *)from, range.length);
+    }
+    ok = ok && fsync(fd) == 0;
+    if (!ok && ftruncate(fd, st.st_size) != 0) {
+        ok = false; // the torn record is skipped by mm_checkpoint_compact
+    }
+    if (close(fd) != 0 || !ok) {
+        return false;
+    }
+    return track_arm();
+}
+
+/**
+ * @brief Stops dirty page tracking and restores the SIGSEGV action.
+ */
+void mm_checkpoint_end(void) {
+    if (!track.on) {
+        return;
+    }
+    if (!track.soft_dirty) {
+        mprotect(track.first, track.npages * track.page,
+                 PROT_READ | PROT_WRITE);
+        sigaction(SIGSEGV, &track.old_action, NULL);
+    }
+    munmap((void *)track.dirty, track.map_size);
+    track.dirty = NULL;
+    track.map_size = 0;
+    track.npages = 0;
+    track.on = false;
+}
+
+/**
+ * @brief Reads the record at `pos` of a delta file and checks it and its
+ *        range headers, so that a record is applied either whole or not
+ *        at all.
+ */
+static bool read_checkpoint_record(int fd, off_t pos, off_t file_size,
+                                   mm_checkpoint_record_t *record) {
+    mm_checkpoint_range_t range;
+    off_t at = pos + (off_t)sizeof(*record);
+    uint64_t i;
+    if (pread(fd, record, sizeof(*record), pos) != (ssize_t)sizeof(*record) ||
+        memcmp(record->magic, MM_CHECKPOINT_DELTA_MAGIC, 4) != 0 ||
+        record->version != MM_CHECKPOINT_VERSION ||
+        record->meta.nbins != (uint64_t)list_length ||
+        record->record_size > (uint64_t)(file_size - pos)) {
+        return false;
+    }
+    for (i = 0; i < record->nranges; i++) {
+        if (pread(fd, &range, sizeof(range), at) != (ssize_t)sizeof(range) ||
+            range.offset > record->meta.heap_size ||
+            range.length > record->meta.heap_size - range.offset) {
+            return false;
+        }
+        at += (off_t)(sizeof(range) + range.length);
+    }
+    return (uint64_t)(at - pos) == record->record_size;
+}
+
+/**
+ * @brief Copies `length` bytes from offset `from_pos` of `from` to offset
+ *        `to_pos` of `to`, through `buf`.
+ */
+static bool checkpoint_copy(int from, off_t from_pos, int to, off_t to_pos,
+                            uint64_t length, unsigned char *buf) {
+    uint64_t done = 0;
+    while (done < length) {
+        size_t len = CHECKPOINT_BUF_SIZE;
+        if (len > length - done) {
+            len = (size_t)(length - done);
+        }
+        if (pread(from, buf, len, from_pos + (off_t)done) != (ssize_t)len ||
+            pwrite(to, buf, len, to_pos + (off_t)done) != (ssize_t)len) {
+            return false;
+        }
+        done += len;
+    }
+    return true;
+}
+
+/**
+ * @brief Merges the records of `delta_path` into the base checkpoint at
+ *        `base_path`, then empties the delta file.
+ *
+ * The base is copied to `base_path`.tmp, the records are applied to the
+ * copy in order, and the copy is synced and renamed over the base, as
+ * mm_checkpoint does. The base file itself is never written: a heap
+ * restored from it maps it copy-on-write, and pages the heap has not yet
+ * written would show any change made to the file in place. The delta file
+ * is only emptied once the new base is in place, so a compaction cut short
+ * by a crash is simply redone.
+ *
+ * @param[in] base_path A file written by mm_checkpoint
+ * @param[in] delta_path Its delta file
+ * @return false if either file cannot be read or the base is not a valid
+ *         checkpoint
+ */
+bool mm_checkpoint_compact(const char *base_path, const char *delta_path) {
+    unsigned char buf[CHECKPOINT_BUF_SIZE];
+    mm_checkpoint_header_t header;
+    mm_checkpoint_record_t record;
+    mm_checkpoint_range_t range;
+    char tmp_path[4096];
+    struct stat st;
+    off_t pos = 0;
+    int base;
+    int delta;
+    int out = -1;
+    bool ok = true;
+
+    base = open(base_path, O_RDONLY);
+    delta = open(delta_path, O_RDWR);
+    if (base < 0 || delta < 0 || !read_checkpoint_header(base, &header) ||
+        fstat(delta, &st) != 0 ||
+        (size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", base_path) >=
+            sizeof(tmp_path)) {
+        ok = false;
+    }
+    while (ok && read_checkpoint_record(delta, pos, st.st_size, &record)) {
+        off_t at = pos + (off_t)sizeof(record);
+        uint64_t i;
+        if (out < 0) {
+            out = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            ok = out >= 0 &&
+                 checkpoint_copy(base, 0, out, 0,
+                                 header.image_offset + header.meta.heap_size,
+                                 buf);
+        }
+        for (i = 0; ok && i < record.nranges; i++) {
+            ok = pread(delta, &range, sizeof(range), at) ==
+                     (ssize_t)sizeof(range) &&
+                 checkpoint_copy(
+                     delta, at + (off_t)sizeof(range), out,
+                     (off_t)(header.image_offset + range.offset),
+                     range.length, buf);
+            at += (off_t)(sizeof(range) + range.length);
+        }
+        header.meta = record.meta;
+        pos += (off_t)record.record_size;
+    }
+    if (out >= 0) {
+        ok = ok &&
+             pwrite(out, &header, sizeof(header), 0) ==
+                 (ssize_t)sizeof(header) &&
+             ftruncate(out, (off_t)(header.image_offset +
+                                    header.meta.heap_size)) == 0 &&
+             fsync(out) == 0;
+        if (close(out) != 0 || !ok || rename(tmp_path, base_path) != 0) {
+            unlink(tmp_path);
+            ok = false;
+        }
+        ok = ok && ftruncate(delta, 0) == 0 && fsync(delta) == 0;
+    }
+    if (base >= 0) {
+        close(base);
+    }
+    if (delta >= 0) {
+        close(delta);
+    }
+    return ok;
+}
+
+/**
+ * @brief Replaces the heap with the checkpoint saved in `path`.
+ *
+ * The memlib heap is reset to the size of the image, and the image is
+ * mapped over it copy-on-write, so pages are only read in when they are
+ * touched and later changes never reach the file. If the heap does not
+ * start on a page boundary, the image is read in instead. Free list links
+ * are offsets, so nothing needs relocating.
+ *
+ * The mapping still shows writes made to the file in place on every page
+ * the heap has not written yet. mm_checkpoint and mm_checkpoint_compact
+ * therefore replace the file rather than write to it, and nothing else
+ * may write to it while the restored heap is in use.
+ *
+ * Every pointer into the previous heap becomes invalid, and dirty page
+ * tracking stops. A file that is not a valid checkpoint leaves the heap
+ * as it was; if loading the image fails, the heap is left empty and the
+ * next malloc starts a new one.
+ *
+ * @param[in] path A file written by mm_checkpoint
+ * @return false if the file is not a valid checkpoint or cannot be loaded
+ */
+bool mm_restore(const char *path) {
+    mm_checkpoint_header_t header;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    char *lo;
+    block_t *epilogue;
+    int index;
+    int fd;
+    bool ok = false;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (!read_checkpoint_header(fd, &header)) {
+        close(fd);
+        return false;
+    }
+
+    mm_checkpoint_end();
+    cur_heap->heap_start = NULL;
+    mem_reset_brk();
+    lo = mem_sbrk((intptr_t)header.meta.heap_size);
+    if (lo == (void *)-1) {
+        close(fd);
+        return false;
+    }
+    if ((uintptr_t)lo % page == 0) {
+        size_t len = (header.meta.heap_size + page - 1) / page * page;
+        ok = mmap(lo, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                  fd, (off_t)header.image_offset) != MAP_FAILED;
+    }
+    if (!ok) {
+        size_t done = 0;
+        while (done < header.meta.heap_size) {
+            ssize_t n = pread(fd, lo + done, header.meta.heap_size - done,
+                              (off_t)(header.image_offset + done));
+            if (n <= 0) {
+                break;
+            }
+            done += (size_t)n;
+        }
+        ok = (done == header.meta.heap_size);
+    }
+    close(fd);
+
+    // The image must end in the epilogue
+    epilogue = (block_t *)(lo + header.meta.heap_size - wsize);
+    if (!ok || get_size(epilogue) != 0 || !get_alloc(epilogue)) {
+        mem_reset_brk();
+        return false;
+    }
+
+    cur_heap->heap_base = lo;
+    cur_heap->heap_start = (block_t *)(lo + header.meta.heap_start);
+    for (index = 0; index < list_length; index++) {
+        cur_heap->seg_list[index] = link_to_block(header.meta.seg_list[index]);
+    }
+    dbg_checkheap(__LINE__);
+    return true;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN HEAP INSTANCES
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * A heap made by mm_heap_create is one anonymous mapping: its heap_t,
+ * then the memory it grows into. The mapping is made with MAP_NORESERVE,
+ * so only the pages the heap grows into are backed, and mm_heap_destroy
+ * gives all of it back with one munmap. A call on a heap makes it the
+ * current heap for the call's duration. Under MM_THREADSAFE, calls on the
+ * default heap take heap_lock; any other heap must be used by one thread
+ * at a time.
+ */
+
+/** @brief Bytes from the start of a heap's mapping to its memory */
+#define HEAP_HEADER_SIZE 4096
+
+/**
+ * @brief Returns the heap that malloc, free, realloc and calloc use.
+ */
+mm_heap_t *mm_heap_default(void) {
+    return &default_heap;
+}
+
+/**
+ * @brief Creates a heap that can grow to `capacity` bytes, with memory of
+ *        its own.
+ * @param[in] capacity
+ * @return The heap, or NULL if the memory cannot be mapped
+ */
+mm_heap_t *mm_heap_create(size_t capacity) {
+    heap_t *heap;
+    heap_t *prev;
+    bool ok;
+
+    capacity = capacity / dsize * dsize;
+    if (capacity < chunksize + dsize ||
+        capacity > (size_t)-1 - HEAP_HEADER_SIZE) {
+        return NULL;
+    }
+    heap = mmap(NULL, HEAP_HEADER_SIZE + capacity, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (heap == MAP_FAILED) {
+        return NULL;
+    }
+    heap->lo = (char *)heap + HEAP_HEADER_SIZE;
+    heap->capacity = capacity;
+
+    prev = cur_heap;
+    cur_heap = heap;
+    ok = mm_init();
+    cur_heap = prev;
+    if (!ok) {
+        munmap(heap, HEAP_HEADER_SIZE + capacity);
+        return NULL;
+    }
+    return heap;
+}
+
+/**
+ * @brief Frees a heap made by mm_heap_create and every block in it. The
+ *        default heap cannot be destroyed.
+ */
+void mm_heap_destroy(mm_heap_t *heap) {
+    if (heap != &default_heap) {
+        munmap(heap, HEAP_HEADER_SIZE + heap->capacity);
+    }
+}
+
+/**
+ * @brief Makes `heap` current for one call, taking heap_lock if it is the
+ *        default heap, which other threads may be using.
+ * @return The heap to give back to heap_leave
+ */
+static heap_t *heap_enter(heap_t *heap) {
+    heap_t *prev = cur_heap;
+    if (heap == &default_heap) {
+        heap_lock();
+    }
+    cur_heap = heap;
+    return prev;
+}
+
+/**
+ * @brief Ends a call begun with heap_enter.
+ */
+static void heap_leave(heap_t *prev) {
+    if (cur_heap == &default_heap) {
+        heap_unlock();
+    }
+    cur_heap = prev;
+}
+
+/**
+ * @brief Allocates `size` bytes from `heap`, like malloc.
+ */
+void *mm_heap_malloc(mm_heap_t *heap, size_t size) {
+    heap_t *prev = heap_enter(heap);
+    void *bp = heap_malloc(size);
+    heap_leave(prev);
+    return bp;
+}
+
+/**
+ * @brief Frees a block of `heap`, like free.
+ */
+void mm_heap_free(mm_heap_t *heap, void *bp) {
+    heap_t *prev = heap_enter(heap);
+    heap_free(bp);
+    heap_leave(prev);
+}
+
+/**
+ * @brief Resizes a block of `heap`, like realloc; the new block is in
+ *        `heap` too.
+ */
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size) {
+    heap_t *prev = heap_enter(heap);
+    void *newptr = heap_realloc(ptr, size);
+    heap_leave(prev);
+    return newptr;
+}
+
+/**
+ * @brief Allocates a zeroed array from `heap`, like calloc.
+ */
+void *mm_heap_calloc(mm_heap_t *heap, size_t elements, size_t size) {
+    heap_t *prev = heap_enter(heap);
+    void *bp = heap_calloc(elements, size);
+    heap_leave(prev);
+    return bp;
+}
+
+/**
+ * @brief Walks `heap` and summarizes its blocks into `stats`, like
+ *        mm_heap_stats.
+ */
+void mm_heap_get_stats(mm_heap_t *heap, mm_heap_stats_t *stats) {
+    heap_t *prev = cur_heap;
+    cur_heap = heap;
+    mm_heap_stats(stats);
+    cur_heap = prev;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        END HEAP INSTANCES
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN SHARED HEAP
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * A shared heap lives in a MAP_SHARED mapping of a file or memfd: a
+ * struct mm_shared header, then up to `capacity` bytes of heap. The header
+ * holds what a heap_t holds, with heap_start and the seg_list heads as
+ * offsets from the start of the heap, so every process can map the file
+ * at a different address.
+ *
+ * A call takes the heap's mutex, loads the header into a heap_t on the
+ * stack and makes it the current heap (shared_enter), runs the ordinary
+ * heap_malloc or heap_free, stores the heap_t back (shared_leave) and
+ * unlocks.
+ */
+
+/** @brief Header at the start of a shared heap mapping */
+struct mm_shared {
+    char magic[8];
+    uint64_t version;
+    pthread_mutex_t lock;  // process-shared and robust
+    uint64_t capacity;     // bytes of heap after the header
+    uint64_t brk;          // bytes of them in use
+    uint64_t heap_start;   // offset of the first block header, 0 if none
+    uint64_t seg_list[15]; // free list heads, 0 if empty
+};
+
+/** @brief Bytes from the start of a shared mapping to its heap */
+#define SHARED_HEADER_SIZE 4096
+
+/** @brief Shared heap magic, followed by SHARED_VERSION */
+#define SHARED_MAGIC "MMSHARED"
+#define SHARED_VERSION 1
+
+/**
+ * @brief Returns the first byte of the heap of a shared mapping.
+ */
+static char *shared_base(mm_shared_t *shm) {
+    return (char *)shm + SHARED_HEADER_SIZE;
+}
+
+/**
+ * @brief Loads `shm` into `heap` and makes it the current heap (lock
+ *        held).
+ * @return The heap that was current before
+ */
+static heap_t *shared_enter(mm_shared_t *shm, heap_t *heap) {
+    heap_t *prev = cur_heap;
+    int index;
+    heap->lo = shared_base(shm);
+    heap->capacity = shm->capacity;
+    heap->brk = shm->brk;
+    heap->heap_base = heap->lo;
+    cur_heap = heap;
+    heap->heap_start = link_to_block(shm->heap_start);
+    for (index = 0; index < list_length; index++) {
+        heap->seg_list[index] = link_to_block(shm->seg_list[index]);
+    }
+    return prev;
+}
+
+/**
+ * @brief Stores the current heap back into `shm` and makes `prev` current
+ *        again (lock held).
+ */
+static void shared_leave(mm_shared_t *shm, heap_t *prev) {
+    int index;
+    shm->brk = cur_heap->brk;
+    shm->heap_start = block_to_link(cur_heap->heap_start);
+    for (index = 0; index < list_length; index++) {
+        shm->seg_list[index] = block_to_link(cur_heap->seg_list[index]);
+    }
+    cur_heap = prev;
+}
+
+/**
+ * @brief Locks a shared heap.
+ *
+ * If the previous owner died holding the lock, its operation may have
+ * been cut short with the free lists half updated, so the whole heap is
+ * checked before the lock is taken over. A heap that fails the check is
+ * poisoned: the lock is released without being marked consistent, which
+ * makes every later lock, in any process, fail with ENOTRECOVERABLE.
+ *
+ * @return false if the heap is poisoned
+ */
+static bool shared_lock(mm_shared_t *shm) {
+    heap_t heap;
+    heap_t *prev;
+    bool ok;
+    int err = pthread_mutex_lock(&shm->lock);
+    if (err != EOWNERDEAD) {
+        return err == 0;
+    }
+    prev = shared_enter(shm, &heap);
+    ok = mm_checkheap(__LINE__);
+    shared_leave(shm, prev);
+    if (!ok) {
+        pthread_mutex_unlock(&shm->lock);
+        return false;
+    }
+    pthread_mutex_consistent(&shm->lock);
+    return true;
+}
+
+/**
+ * @brief Turns the empty file `fd` into a shared heap of `capacity` bytes
+ *        and maps it.
+ *
+ * The file is sized with ftruncate, so its pages are only backed once the
+ * heap grows into them. The magic is written last, after the heap has
+ * been initialized, so mm_shared_attach rejects a half-made heap.
+ *
+ * @param[in] fd A file or memfd open for reading and writing
+ * @param[in] capacity The most bytes the heap may grow to
+ * @return The heap, or NULL if the file cannot be sized or mapped
+ */
+mm_shared_t *mm_shared_create(int fd, size_t capacity) {
+    pthread_mutexattr_t attr;
+    heap_t heap = {0};
+    heap_t *prev;
+    mm_shared_t *shm;
+    bool ok;
+
+    capacity = capacity / dsize * dsize;
+    if (capacity < chunksize + dsize ||
+        ftruncate(fd, (off_t)(SHARED_HEADER_SIZE + capacity)) != 0) {
+        return NULL;
+    }
+    shm = mmap(NULL, SHARED_HEADER_SIZE + capacity, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+    memset(shm, 0, sizeof(*shm));
+    shm->version = SHARED_VERSION;
+    shm->capacity = capacity;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    ok = (pthread_mutex_init(&shm->lock, &attr) == 0);
+    pthread_mutexattr_destroy(&attr);
+
+    if (ok) {
+        prev = shared_enter(shm, &heap);
+        ok = mm_init();
+        shared_leave(shm, prev);
+    }
+    if (!ok) {
+        munmap(shm, SHARED_HEADER_SIZE + capacity);
+        return NULL;
+    }
+    memcpy(shm->magic, SHARED_MAGIC, sizeof(shm->magic));
+    return shm;
+}
+
+/**
+ * @brief Maps the shared heap made by mm_shared_create in `fd`.
+ * @param[in] fd The heap's file or memfd, open for reading and writing
+ * @return The heap, or NULL if `fd` does not hold one
+ */
+mm_shared_t *mm_shared_attach(int fd) {
+    struct stat st;
+    mm_shared_t *shm;
+    if (fstat(fd, &st) != 0 || st.st_size < SHARED_HEADER_SIZE) {
+        return NULL;
+    }
+    shm = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, 0);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+    if (memcmp(shm->magic, SHARED_MAGIC, sizeof(shm->magic)) != 0 ||
+        shm->version != SHARED_VERSION ||
+        SHARED_HEADER_SIZE + shm->capacity != (uint64_t)st.st_size) {
+        munmap(shm, (size_t)st.st_size);
+        return NULL;
+    }
+    return shm;
+}
+
+/**
+ * @brief Unmaps a shared heap from this process. Other processes keep
+ *        using it.
+ */
+void mm_shared_detach(mm_shared_t *shm) {
+    munmap(shm, SHARED_HEADER_SIZE + shm->capacity);
+}
+
+/**
+ * @brief Allocates `size` bytes from a shared heap.
+ * @return A 16-byte aligned payload pointer, or NULL if there is no room
+ *         or the heap is poisoned
+ */
+void *mm_shared_malloc(mm_shared_t *shm, size_t size) {
+    heap_t heap;
+    heap_t *prev;
+    void *bp;
+    if (!shared_lock(shm)) {
+        return NULL;
+    }
+    prev = shared_enter(shm, &heap);
+    bp = heap_malloc(size);
+    shared_leave(shm, prev);
+    pthread_mutex_unlock(&shm->lock);
+    return bp;
+}
+
+/**
+ * @brief Frees a block of a shared heap, which any process may have
+ *        allocated. Does nothing if the heap is poisoned.
+ */
+void mm_shared_free(mm_shared_t *shm, void *bp) {
+    heap_t heap;
+    heap_t *prev;
+    if (!shared_lock(shm)) {
+        return;
+    }
+    prev = shared_enter(shm, &heap);
+    heap_free(bp);
+    shared_leave(shm, prev);
+    pthread_mutex_unlock(&shm->lock);
+}
+
+/**
+ * @brief Checks a shared heap like mm_checkheap.
+ * @return false if a check failed or the heap is poisoned
+ */
+bool mm_shared_checkheap(mm_shared_t *shm, int line) {
+    heap_t heap;
+    heap_t *prev;
+    bool ok;
+    if (!shared_lock(shm)) {
+        return false;
+    }
+    prev = shared_enter(shm, &heap);
+    ok = mm_checkheap(line);
+    shared_leave(shm, prev);
+    pthread_mutex_unlock(&shm->lock);
+    return ok;
+}
+
+/**
+ * @brief Returns the offset of `ptr` in a shared heap, which is the same
+ *        in every process (0 for NULL).
+ */
+uint64_t mm_shared_offset(mm_shared_t *shm, const void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    return (uint64_t)((const char *)ptr - shared_base(shm));
+}
+
+/**
+ * @brief Returns the pointer at `offset` in a shared heap in this process
+ *        (NULL for 0).
+ */
+void *mm_shared_pointer(mm_shared_t *shm, uint64_t offset) {
+    if (offset == 0) {
+        return NULL;
+    }
+    return shared_base(shm) + offset;
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        END SHARED HEAP
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN ARENAS
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * An arena takes chunks from the heap with malloc and hands out their
+ * bytes by bumping a cursor. Nothing is freed on its own; mm_arena_reset
+ * frees every chunk but one, so releasing a request's worth of objects
+ * costs one free per chunk instead of one free and coalesce per object.
+ * Requests larger than a quarter of a chunk get a chunk of their own,
+ * linked behind the current one so that its free space is not wasted.
+ */
+
+/** @brief Default bytes of a chunk's payload, header included */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/** @brief A chunk of an arena, followed by its bytes */
+typedef struct arena_chunk {
+    struct arena_chunk *next; // older chunk
+    size_t size;              // bytes after the header
+} arena_chunk_t;
+
+struct mm_arena {
+    arena_chunk_t *chunks; // the current chunk first
+    char *cursor;          // next free byte of the current chunk
+    char *limit;           // end of the current chunk
+    size_t chunk_size;     // size of a regular chunk
+};
+
+/**
+ * @brief Returns the first byte of a chunk; the header is one dsize, so
+ *        the bytes stay 16-byte aligned.
+ */
+static char *arena_chunk_bytes(arena_chunk_t *chunk) {
+    return (char *)chunk + dsize;
+}
 
-    // Initialize heap if it isn't initialized
-    if (heap_start == NULL) {
-        mm_init();
+/**
+ * @brief Allocates a chunk of `size` bytes from the heap.
+ */
+static arena_chunk_t *arena_chunk_new(size_t size) {
+    arena_chunk_t *chunk = malloc(dsize + size);
+    if (chunk != NULL) {
+        chunk->size = size;
     }
+    return chunk;
+}
 
-    // Ignore spurious request
-    if (size == 0) {
-        dbg_ensures(mm_checkheap(__LINE__));
+/**
+ * @brief Creates an arena whose chunks hold `chunk_size` bytes each
+ *        (0 for the default).
+ * @return The arena, or NULL if the heap is out of memory
+ */
+mm_arena_t *mm_arena_create(size_t chunk_size) {
+    mm_arena_t *arena;
+    if (chunk_size == 0) {
+        chunk_size = ARENA_CHUNK_SIZE - dsize;
+    }
+    chunk_size = round_up(chunk_size, dsize);
+    arena = malloc(sizeof(*arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->chunks = NULL;
+    arena->cursor = NULL;
+    arena->limit = NULL;
+    arena->chunk_size = chunk_size;
+    return arena;
+}
+
+/**
+ * @brief Allocates `size` bytes from an arena.
+ *
+ * The fast path is a compare and an add. When the current chunk is full,
+ * a new one is taken from the heap and the rest of the old one is given
+ * up.
+ *
+ * @return A 16-byte aligned pointer, or NULL (also for size 0)
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size) {
+    arena_chunk_t *chunk;
+    char *bp;
+    if (size == 0 || size > (size_t)-1 - 2 * dsize) {
+        return NULL;
+    }
+    size = align_up(size, dsize);
+    if (size <= (size_t)(arena->limit - arena->cursor)) {
+        bp = arena->cursor;
+        arena->cursor += size;
         return bp;
     }
 
-    // Adjust block size to include overhead and to meet alignment requirements
-    asize = round_up(size + wsize, dsize);
+    if (size > arena->chunk_size / 4) {
+        chunk = arena_chunk_new(size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        if (arena->chunks == NULL) {
+            chunk->next = NULL;
+            arena->chunks = chunk;
+        } else {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        }
+        return arena_chunk_bytes(chunk);
+    }
 
-    // Search the free list for a fit
-    block = find_fit(asize);
+    chunk = arena_chunk_new(arena->chunk_size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    bp = arena_chunk_bytes(chunk);
+    arena->cursor = bp + size;
+    arena->limit = bp + chunk->size;
+    return bp;
+}
 
-    // If no fit is found, request more memory, and then and place the block
-    if (block == NULL) {
-        // Always request at least chunksize
-        extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
-        // extend_heap returns an error
-        if (block == NULL) {
-            return bp;
+/**
+ * @brief Frees everything allocated from an arena at once.
+ *
+ * Every chunk goes back to the heap except one regular chunk, which
+ * becomes the current chunk again, so an arena reused per request does
+ * not call malloc until it outgrows one chunk.
+ */
+void mm_arena_reset(mm_arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+    arena_chunk_t *keep = NULL;
+    while (chunk != NULL) {
+        arena_chunk_t *next = chunk->next;
+        if (keep == NULL && chunk->size == arena->chunk_size) {
+            keep = chunk;
+        } else {
+            free(chunk);
         }
+        chunk = next;
+    }
+    arena->chunks = keep;
+    if (keep == NULL) {
+        arena->cursor = NULL;
+        arena->limit = NULL;
+    } else {
+        keep->next = NULL;
+        arena->cursor = arena_chunk_bytes(keep);
+        arena->limit = arena->cursor + keep->size;
     }
+}
 
-    // The block should be marked as free
-    dbg_assert(!get_alloc(block));
+/**
+ * @brief Frees an arena and everything allocated from it.
+ */
+void mm_arena_destroy(mm_arena_t *arena) {
+    arena_chunk_t *chunk = arena->chunks;
+    while (chunk != NULL) {
+        arena_chunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
 
-    // Try to split the block if too large
-    split_block(block, asize);
+/*
+ * ---------------------------------------------------------------------------
+ *                        END ARENAS
+ * ---------------------------------------------------------------------------
+ */
 
-    bp = header_to_payload(block);
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN OBJECT POOLS
+ * ---------------------------------------------------------------------------
+ */
 
-    dbg_ensures(mm_checkheap(__LINE__));
-    // printf("printing heap in malloc... \n");
-    // print_heap();
-    return bp;
+/*
+ * A pool hands out objects of one size from chunks it takes from the heap
+ * with malloc, keeping its free objects on a singly linked list. An
+ * object's memory stays in the pool until mm_pool_destroy, so it is
+ * type-stable. In a pool with a constructor, as in Bonwick's slab
+ * allocator, objects are constructed once when their chunk is taken and
+ * destroyed when the pool is; a freed object keeps its constructed state,
+ * so the free list link is kept in a word after the object instead of in
+ * it.
+ */
+
+/** @brief Bytes a pool asks for per chunk, unless its objects are larger */
+#define POOL_CHUNK_SIZE (16 * 1024)
+
+/** @brief Fewest objects a pool chunk holds */
+#define POOL_MIN_OBJECTS 8
+
+/** @brief A chunk of a pool; its objects follow, aligned */
+typedef struct pool_chunk {
+    struct pool_chunk *next;
+} pool_chunk_t;
+
+struct mm_pool {
+    void *free_list;      // free objects, linked through their link word
+    pool_chunk_t *chunks; // every chunk the pool has taken
+    size_t obj_size;
+    size_t align;
+    size_t link_offset; // where the link word is in an object
+    size_t stride;      // bytes from one object to the next
+    size_t per_chunk;   // objects per chunk
+    mm_pool_ctor_t ctor;
+    mm_pool_dtor_t dtor;
+    void *arg; // passed to ctor and dtor
+};
+
+/**
+ * @brief Returns the address of the free list link of `obj`.
+ */
+static void **pool_link(mm_pool_t *pool, void *obj) {
+    return (void **)((char *)obj + pool->link_offset);
 }
 
 /**
- * @brief
- *
- * <What does this function do?>
- * <What are the function's arguments?>
- * <What is the function's return value?>
- * <Are there any preconditions or postconditions?>
- *
- * @param[in] bp
+ * @brief Returns the first object of a chunk.
  */
-void free(void *bp) {
-    if (bp == NULL) {
-        return;
+static char *pool_chunk_objects(mm_pool_t *pool, pool_chunk_t *chunk) {
+    return (char *)align_up((uintptr_t)(chunk + 1), pool->align);
+}
+
+/**
+ * @brief Takes a new chunk from the heap, constructs its objects and puts
+ *        them on the free list, lowest address first.
+ */
+static bool pool_refill(mm_pool_t *pool) {
+    pool_chunk_t *chunk;
+    char *objects;
+    size_t i;
+    chunk = malloc(sizeof(*chunk) + pool->align - 1 +
+                   pool->per_chunk * pool->stride);
+    if (chunk == NULL) {
+        return false;
+    }
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    objects = pool_chunk_objects(pool, chunk);
+    for (i = pool->per_chunk; i-- > 0;) {
+        void *obj = objects + i * pool->stride;
+        if (pool->ctor != NULL) {
+            pool->ctor(obj, pool->arg);
+        }
+        *pool_link(pool, obj) = pool->free_list;
+        pool->free_list = obj;
     }
+    return true;
+}
 
-    block_t *block = payload_to_header(bp);
-    size_t size = get_size(block);
+/**
+ * @brief Creates a pool of `obj_size`-byte objects aligned to `align`
+ *        whose objects are built by `ctor` and torn down by `dtor` (either
+ *        may be NULL).
+ * @return The pool, or NULL if `align` is not a power of two or the heap
+ *         is out of memory
+ */
+mm_pool_t *mm_pool_create_cache(size_t obj_size, size_t align,
+                                mm_pool_ctor_t ctor, mm_pool_dtor_t dtor,
+                                void *arg) {
+    mm_pool_t *pool;
+    if (align == 0) {
+        align = dsize;
+    }
+    if ((align & (align - 1)) != 0 || obj_size == 0 ||
+        obj_size > (size_t)-1 / (4 * POOL_MIN_OBJECTS) ||
+        align > (size_t)-1 / (4 * POOL_MIN_OBJECTS)) {
+        return NULL;
+    }
+    pool = malloc(sizeof(*pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->free_list = NULL;
+    pool->chunks = NULL;
+    pool->obj_size = obj_size;
+    pool->align = max(align, sizeof(void *));
+    if (ctor != NULL) {
+        pool->link_offset = align_up(obj_size, sizeof(void *));
+        pool->stride = pool->link_offset + sizeof(void *);
+    } else {
+        pool->link_offset = 0;
+        pool->stride = max(obj_size, sizeof(void *));
+    }
+    pool->stride = align_up(pool->stride, pool->align);
+    pool->per_chunk = max(POOL_CHUNK_SIZE / pool->stride, POOL_MIN_OBJECTS);
+    pool->ctor = ctor;
+    pool->dtor = dtor;
+    pool->arg = arg;
+    return pool;
+}
 
-    // The block should be marked as allocated
-    dbg_assert(get_alloc(block));
+/**
+ * @brief Creates a pool of `obj_size`-byte objects aligned to `align`
+ *        (0 for 16 bytes).
+ */
+mm_pool_t *mm_pool_create(size_t obj_size, size_t align) {
+    return mm_pool_create_cache(obj_size, align, NULL, NULL, NULL);
+}
 
-    // Mark the block as free
-    // printf("start writing \n");
-    write_block(block, size, false, get_prev_alloc(block));
-    // printf("writing successful\n");
-    update_next_prev_alloc(block, false);
-    // printf("update_next_prev_alloc successful\n");
+/**
+ * @brief Takes an object from the pool's free list, refilling it from the
+ *        heap when empty.
+ * @return The object, or NULL if the heap is out of memory
+ */
+void *mm_pool_alloc(mm_pool_t *pool) {
+    void *obj = pool->free_list;
+    if (obj == NULL) {
+        if (!pool_refill(pool)) {
+            return NULL;
+        }
+        obj = pool->free_list;
+    }
+    pool->free_list = *pool_link(pool, obj);
+    return obj;
+}
 
-    // Try to coalesce the block with its neighbors
-    block = coalesce_block(block);
-    add_to_list(block);
-    // printf("printing linkedList in free\n...");
-    // print_linkedList();
-    // printf("coalesce successful\n");
-    dbg_ensures(mm_checkheap(__LINE__));
+/**
+ * @brief Puts an object back on its pool's free list. In a pool with a
+ *        constructor, the object must be back in its constructed state.
+ */
+void mm_pool_free(mm_pool_t *pool, void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+    *pool_link(pool, obj) = pool->free_list;
+    pool->free_list = obj;
 }
 
 /**
- * @brief
+ * @brief Runs the destructor on every object of the pool, gives its
+ *        chunks back to the heap and frees the pool.
+ */
+void mm_pool_destroy(mm_pool_t *pool) {
+    pool_chunk_t *chunk = pool->chunks;
+    while (chunk != NULL) {
+        pool_chunk_t *next = chunk->next;
+        if (pool->dtor != NULL) {
+            char *objects = pool_chunk_objects(pool, chunk);
+            size_t i;
+            for (i = 0; i < pool->per_chunk; i++) {
+                pool->dtor(objects + i * pool->stride, pool->arg);
+            }
+        }
+        free(chunk);
+        chunk = next;
+    }
+    free(pool);
+}
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        END OBJECT POOLS
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        BEGIN PRELOAD LIBRARY
+ * ---------------------------------------------------------------------------
+ */
+
+/*
+ * Compiled with MM_PRELOAD, mm.c is a drop-in replacement for the C
+ * library's allocator:
  *
- * <What does this function do?>
- * <What are the function's arguments?>
- * <What is the function's return value?>
- * <Are there any preconditions or postconditions?>
+ *   cc -O2 -fPIC -shared -pthread -DMM_PRELOAD -o libmm.so mm.c
+ *   LD_PRELOAD=./libmm.so ./program
  *
- * @param[in] ptr
- * @param[in] size
- * @return
+ * memlib is left out. In its place, the mem_* functions below hand out a
+ * single mmap'ed reservation, so the default heap, checkpoints and
+ * snapshots work unchanged; pages are only backed once extend_heap
+ * touches them. Besides malloc, free, realloc and calloc, the library
+ * exports the other allocation functions a program may call, so that no
+ * block ever comes from one allocator and goes back to the other. As in
+ * glibc, zero-byte requests (malloc(0), realloc(NULL, 0), calloc(0, n))
+ * get a unique block, and failed allocations set errno to ENOMEM.
+ *
+ * Every entry point runs under heap_lock, as MM_PRELOAD implies
+ * MM_THREADSAFE. fork holds the lock across the call, so that the child
+ * gets a consistent heap and a usable lock even if another thread of the
+ * parent was in malloc.
  */
-void *realloc(void *ptr, size_t size) {
-    block_t *block = payload_to_header(ptr);
-    size_t copysize;
-    void *newptr;
+#ifdef MM_PRELOAD
+#ifdef DRIVER
+#error "MM_PRELOAD replaces the C library's malloc and excludes DRIVER"
+#endif
 
-    // If size == 0, then free block and return NULL
-    if (size == 0) {
-        free(ptr);
-        return NULL;
+/** @brief Largest reservation tried for the default heap */
+#define PRELOAD_RESERVE ((size_t)1 << 40)
+
+static char *preload_lo;        // the reservation, NULL until first used
+static size_t preload_reserved; // its size
+static size_t preload_brk;      // bytes of it in the heap
+
+/**
+ * reserve address space for the default heap, halving the request until
+ * the kernel accepts it
+ */
+static bool preload_reserve(void) {
+    size_t size;
+    for (size = PRELOAD_RESERVE; size >= chunksize; size /= 2) {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p != MAP_FAILED) {
+            preload_lo = p;
+            preload_reserved = size;
+            return true;
+        }
     }
+    return false;
+}
 
-    // If ptr is NULL, then equivalent to malloc
-    if (ptr == NULL) {
-        return malloc(size);
+/**
+ * memlib's mem_sbrk, over the reservation
+ */
+void *mem_sbrk(intptr_t incr) {
+    char *old;
+    if (preload_lo == NULL && !preload_reserve()) {
+        errno = ENOMEM;
+        return (void *)-1;
+    }
+    if (incr < 0 || (size_t)incr > preload_reserved - preload_brk) {
+        errno = ENOMEM;
+        return (void *)-1;
     }
+    old = preload_lo + preload_brk;
+    preload_brk += (size_t)incr;
+    return old;
+}
 
-    // Otherwise, proceed with reallocation
-    newptr = malloc(size);
+void mem_reset_brk(void) {
+    preload_brk = 0;
+}
 
-    // If malloc fails, the original block is left untouched
-    if (newptr == NULL) {
-        return NULL;
-    }
+void *mem_heap_lo(void) {
+    return preload_lo;
+}
 
-    // Copy the old data
-    copysize = get_payload_size(block); // gets size of old payload
-    if (size < copysize) {
-        copysize = size;
-    }
-    memcpy(newptr, ptr, copysize);
+void *mem_heap_hi(void) {
+    return preload_lo + preload_brk - 1;
+}
 
-    // Free the old block
-    free(ptr);
+size_t mem_heapsize(void) {
+    return preload_brk;
+}
 
-    return newptr;
+/**
+ * fork handlers: the parent holds heap_lock across fork, and the child,
+ * whose only thread is the one that called fork, starts with a fresh one
+ */
+static void preload_prepare(void) {
+    heap_lock();
+}
+
+static void preload_parent(void) {
+    heap_unlock();
+}
+
+static void preload_child(void) {
+    atomic_store_explicit(&heap_lock_word, 0, memory_order_relaxed);
 }
 
 /**
- * @brief
- *
- * <What does this function do?>
- * <What are the function's arguments?>
- * <What is the function's return value?>
- * <Are there any preconditions or postconditions?>
- *
- * @param[in] elements
- * @param[in] size
- * @return
+ * install the fork handlers when the library is loaded, since
+ * pthread_atfork may itself call malloc
  */
-void *calloc(size_t elements, size_t size) {
-    void *bp;
-    size_t asize = elements * size;
+__attribute__((constructor)) static void preload_init(void) {
+    pthread_atfork(preload_prepare, preload_parent, preload_child);
+}
 
-    if (elements == 0) {
+/**
+ * @brief Like aligned_alloc, but rounds `align` up to a power of two, as
+ *        glibc does.
+ */
+void *memalign(size_t align, size_t size) {
+    size_t pow2 = dsize;
+    while (pow2 < align && pow2 <= (size_t)-1 / 2) {
+        pow2 *= 2;
+    }
+    if (pow2 < align) {
+        errno = EINVAL;
         return NULL;
     }
-    if (asize / elements != size) {
-        // Multiplication overflowed
+    return mm_aligned_alloc(pow2, size);
+}
+
+/**
+ * @brief Allocates `size` bytes aligned to `align`, a power of two.
+ */
+void *aligned_alloc(size_t align, size_t size) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
         return NULL;
     }
+    return mm_aligned_alloc(align, size);
+}
 
-    bp = malloc(asize);
+/**
+ * @brief Stores in `*memptr` a block of `size` bytes aligned to `align`, a
+ *        power of two multiple of sizeof(void *).
+ * @return 0, EINVAL for a bad alignment, or ENOMEM
+ */
+int posix_memalign(void **memptr, size_t align, size_t size) {
+    int saved_errno = errno; // which posix_memalign must not change
+    void *bp;
+    if (align == 0 || align % sizeof(void *) != 0 ||
+        (align & (align - 1)) != 0) {
+        return EINVAL;
+    }
+    bp = mm_aligned_alloc(align, size);
+    errno = saved_errno;
     if (bp == NULL) {
-        return NULL;
+        return ENOMEM;
     }
+    *memptr = bp;
+    return 0;
+}
 
-    // Initialize all bits to 0
-    memset(bp, 0, asize);
+/**
+ * @brief Allocates `size` bytes aligned to the page size.
+ */
+void *valloc(size_t size) {
+    return mm_aligned_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
 
-    return bp;
+/**
+ * @brief Like valloc, with `size` rounded up to whole pages.
+ */
+void *pvalloc(size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > (size_t)-1 - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return mm_aligned_alloc(page, round_up(size == 0 ? 1 : size, page));
+}
+
+/**
+ * @brief Returns the payload bytes usable at `bp`, as mm_usable_size.
+ */
+size_t malloc_usable_size(void *bp) {
+    return mm_usable_size(bp);
 }
+#endif /* MM_PRELOAD */
+
+/*
+ * ---------------------------------------------------------------------------
+ *                        END PRELOAD LIBRARY
+ * ---------------------------------------------------------------------------
+ */
 
 /**
  * @brief